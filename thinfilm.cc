@@ -1,9 +1,269 @@
 #include "thinfilm.hh"
+#include "thinfilm_catalog.hh"
+#include "thinfilm_distributed.hh"
+#include "thinfilm_stream.hh"
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
-int main() {
+/*
+   thinfilm            one problem in text from stdin, see above
+   thinfilm --binary   stream of binary problems from stdin to binary results
+                       on stdout, see thinfilm_stream.hh
+   thinfilm --binary input
+                       same with the problems read from a memory mapped file
+   thinfilm --make-catalog catalog [input]
+                       catalog of the layers of a stream of binary problems
+                       read from stdin or input, their media and angles are
+                       left out
+   thinfilm --make-spectra catalog spectra
+                       spectrum file of zeros for the stacks of catalog, on
+                       the grid read in text from stdin: nIncident, nExit,
+                       number of wavelengths, wavelengths, number of angles,
+                       cos(theta) of every angle
+   thinfilm --catalog catalog spectra
+                       evaluate the stacks of a mapped catalog into a mapped
+                       spectrum file created on the grid, see
+                       thinfilm_catalog.hh
+   thinfilm --coordinate port catalog spectra [stacks [wavelengths [timeout]]]
+                       same, with the shards of stacks x wavelengths evaluated
+                       by the workers connected to port, resumed from
+                       spectra.checkpoint. A shard not answered in timeout
+                       seconds (600, 0 waits forever) goes to another worker,
+                       see thinfilm_distributed.hh
+   thinfilm --work host port
+                       evaluate the shards of a coordinator
+   thinfilm --stats ...
+                       same, then the counters and timers of the kernels as
+                       JSON on stderr (all zero unless built with
+                       -DTHINFILM_STATS=1), see thinfilm_stats.hh
+ */
+int binary_main(const char *path) {
+    thinfilm::WorkStealingPool pool;
+
+    if (path == 0) {
+        thinfilm::FileSource source(stdin);
+        if (!thinfilm::run_binary_pipeline(source, stdout, pool)) {
+            cerr << "thinfilm: truncated input or write error" << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        cerr << "thinfilm: cannot open " << path << endl;
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    void *data = size > 0 ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : 0;
+    if (data == MAP_FAILED) {
+        cerr << "thinfilm: cannot map " << path << endl;
+        close(fd);
+        return 1;
+    }
+    if (data != 0) {
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+
+    thinfilm::MemorySource source(data, size);
+    bool ok = thinfilm::run_binary_pipeline(source, stdout, pool);
+
+    if (data != 0) {
+        munmap(data, size);
+    }
+    close(fd);
+
+    if (!ok) {
+        cerr << "thinfilm: truncated input or write error" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int make_catalog_main(const char *catalogPath, const char *path) {
+    FILE *input = path ? fopen(path, "rb") : stdin;
+    if (input == 0) {
+        cerr << "thinfilm: cannot open " << path << endl;
+        return 1;
+    }
+
+    thinfilm::FileSource source(input);
+    thinfilm::ProblemChunk problems;
+    thinfilm::ReadStatus status;
+    while ((status = thinfilm::read_problem(source, &problems)) == thinfilm::ReadStatus::Ok) {
+    }
+    if (path) {
+        fclose(input);
+    }
+    if (status != thinfilm::ReadStatus::End) {
+        cerr << "thinfilm: truncated input" << endl;
+        return 1;
+    }
+
+    thinfilm::StackCatalog catalog;
+    if (!catalog.create(catalogPath, problems.stacks)) {
+        cerr << "thinfilm: cannot write " << catalogPath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int make_spectra_main(const char *catalogPath, const char *spectraPath) {
+    thinfilm::StackCatalog catalog;
+    if (!catalog.open(catalogPath)) {
+        cerr << "thinfilm: invalid catalog " << catalogPath << endl;
+        return 1;
+    }
+
+    thinfilm::complex nIncident, nExit;
+    size_t wavelengthCount = 0, angleCount = 0;
+    cin >> nIncident >> nExit >> wavelengthCount;
+    vector<double> wavelengths(cin && wavelengthCount < thinfilm::maximumGridCount ? wavelengthCount : 0);
+    for (size_t k = 0; k < wavelengths.size(); ++k) {
+        cin >> wavelengths[k];
+    }
+    cin >> angleCount;
+    vector<thinfilm::complex> incidentCosTheta(cin && angleCount < thinfilm::maximumGridCount ? angleCount : 0);
+    for (size_t a = 0; a < incidentCosTheta.size(); ++a) {
+        cin >> incidentCosTheta[a];
+    }
+    if (!cin || wavelengths.empty() || incidentCosTheta.empty() ||
+        wavelengths.size() * incidentCosTheta.size() >= thinfilm::maximumGridCount) {
+        cerr << "thinfilm: invalid grid" << endl;
+        return 1;
+    }
+
+    thinfilm::SpectrumFile spectra;
+    if (!spectra.create(spectraPath, catalog.size(), nIncident, nExit, wavelengths.data(), wavelengths.size(),
+                        incidentCosTheta.data(), incidentCosTheta.size())) {
+        cerr << "thinfilm: cannot write " << spectraPath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int catalog_main(const char *catalogPath, const char *spectraPath) {
+    thinfilm::StackCatalog catalog;
+    if (!catalog.open(catalogPath) || !catalog.check_offsets()) {
+        cerr << "thinfilm: invalid catalog " << catalogPath << endl;
+        return 1;
+    }
+    thinfilm::SpectrumFile spectra;
+    if (!spectra.open(spectraPath, true) || spectra.size() != catalog.size()) {
+        cerr << "thinfilm: invalid spectrum file " << spectraPath << endl;
+        return 1;
+    }
+
+    thinfilm::WorkStealingPool pool;
+    catalog.file().advise_sequential();
+    if (!thinfilm::evaluate_catalog(pool, catalog, &spectra)) {
+        cerr << "thinfilm: cannot write " << spectraPath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int coordinate_main(int argc, char **argv) {
+    thinfilm::StackCatalog catalog;
+    if (!catalog.open(argv[3]) || !catalog.check_offsets()) {
+        cerr << "thinfilm: invalid catalog " << argv[3] << endl;
+        return 1;
+    }
+    thinfilm::SpectrumFile spectra;
+    if (!spectra.open(argv[4], true) || spectra.size() != catalog.size()) {
+        cerr << "thinfilm: invalid spectrum file " << argv[4] << endl;
+        return 1;
+    }
+
+    thinfilm::CoordinatorOptions options;
+    if (argc > 5) {
+        options.stacksPerShard = strtoull(argv[5], 0, 10);
+    }
+    if (argc > 6) {
+        options.wavelengthsPerShard = strtoull(argv[6], 0, 10);
+    }
+    if (argc > 7) {
+        options.shardTimeout = atoi(argv[7]);
+    }
+    int fd = thinfilm::listen_tcp(atoi(argv[2]));
+    if (fd < 0) {
+        cerr << "thinfilm: cannot listen on port " << argv[2] << endl;
+        return 1;
+    }
+
+    string checkpoint = string(argv[4]) + ".checkpoint";
+    thinfilm::Coordinator coordinator(catalog, &spectra, options);
+    bool ok = coordinator.run(fd, checkpoint.c_str());
+    close(fd);
+    if (!ok) {
+        cerr << "thinfilm: cannot write " << argv[4] << " or " << checkpoint << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int work_main(const char *host, const char *port) {
+    int fd = thinfilm::connect_tcp(host, port);
+    if (fd < 0) {
+        cerr << "thinfilm: cannot connect to " << host << ":" << port << endl;
+        return 1;
+    }
+    thinfilm::WorkStealingPool pool;
+    bool ok = thinfilm::run_worker(fd, pool);
+    close(fd);
+    if (!ok) {
+        cerr << "thinfilm: connection to the coordinator lost" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int text_main();
+
+int main(int argc, char **argv) {
+
+    bool stats = argc > 1 && strcmp(argv[1], "--stats") == 0;
+    if (stats) {
+        --argc;
+        ++argv;
+    }
+
+    int status;
+    if (argc > 1 && strcmp(argv[1], "--binary") == 0) {
+        status = binary_main(argc > 2 ? argv[2] : 0);
+    } else if (argc > 2 && strcmp(argv[1], "--make-catalog") == 0) {
+        status = make_catalog_main(argv[2], argc > 3 ? argv[3] : 0);
+    } else if (argc > 3 && strcmp(argv[1], "--make-spectra") == 0) {
+        status = make_spectra_main(argv[2], argv[3]);
+    } else if (argc > 3 && strcmp(argv[1], "--catalog") == 0) {
+        status = catalog_main(argv[2], argv[3]);
+    } else if (argc > 4 && strcmp(argv[1], "--coordinate") == 0) {
+        status = coordinate_main(argc, argv);
+    } else if (argc > 3 && strcmp(argv[1], "--work") == 0) {
+        status = work_main(argv[2], argv[3]);
+    } else {
+        status = text_main();
+    }
+
+    if (stats) {
+        thinfilm::write_statistics_json(cerr, thinfilm::statistics());
+        cerr << endl;
+    }
+    return status;
+}
+
+int text_main() {
 
     thinfilm::complex incidentCosTheta;
     thinfilm::complex nIncident, nExit;
@@ -3,33 +3,174 @@
 
 #include <complex>
 #include <cmath>
+#include <limits>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "thinfilm_stats.hh"
+
 // This version is based on https://arxiv.org/abs/1603.02720
 
 namespace thinfilm {
 
 typedef std::complex<double> complex;
 
-struct Layer {
+// Layer in the precision T, the kernels are templates on it
+// e.g. BasicLayer<float> for fast screening
+template <class T>
+struct BasicLayer {
     // Thickness of the layer in unit of wavelength
     // thickness == 1  <=> thickness = 1 wavelength
-    double thickness;
+    T thickness;
 
     // with k non-negative
     // example (1.5, +0.001)
-    complex refractiveIndex;
+    std::complex<T> refractiveIndex;
+};
+
+typedef BasicLayer<double> Layer;
+
+// Non-owning view of a stack stored as a thickness array and an index array
+//
+// The kernels are templates on the stack type, they accept a StackView as
+// well as a std::vector<Layer>
+struct StackView {
+    StackView()
+        : thicknesses(0), refractiveIndices(0), count(0) {
+    }
+    StackView(const double *thicknesses, const complex *refractiveIndices, std::size_t count)
+        : thicknesses(thicknesses), refractiveIndices(refractiveIndices), count(count) {
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+    Layer operator[](std::size_t i) const {
+        Layer layer;
+        layer.thickness = thicknesses[i];
+        layer.refractiveIndex = refractiveIndices[i];
+        return layer;
+    }
+
+    const double *thicknesses;
+    const complex *refractiveIndices;
+    std::size_t count;
+};
+
+// Stacks packed one after the other in two contiguous arrays
+//
+// A batch of stacks lives in one buffer: once reserved, adding stacks and
+// evaluating them does not touch the allocator.
+class StackArena {
+public:
+    StackArena() : offsets_(1, 0) {
+    }
+
+    void reserve(std::size_t stackCount, std::size_t layerCount) {
+        offsets_.reserve(stackCount + 1);
+        thicknesses_.reserve(layerCount);
+        refractiveIndices_.reserve(layerCount);
+    }
+
+    void clear() {
+        offsets_.resize(1);
+        thicknesses_.clear();
+        refractiveIndices_.clear();
+    }
+
+    // Append a stack of count layers, returns its position
+    std::size_t add(const double *thicknesses, const complex *refractiveIndices,
+                    std::size_t count) {
+        thicknesses_.insert(thicknesses_.end(), thicknesses, thicknesses + count);
+        refractiveIndices_.insert(refractiveIndices_.end(), refractiveIndices,
+                                  refractiveIndices + count);
+        offsets_.push_back(thicknesses_.size());
+        return offsets_.size() - 2;
+    }
+
+    template <class Stack>
+    std::size_t add(const Stack &layers) {
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            thicknesses_.push_back(layers[i].thickness);
+            refractiveIndices_.push_back(layers[i].refractiveIndex);
+        }
+        offsets_.push_back(thicknesses_.size());
+        return offsets_.size() - 2;
+    }
+
+    // Number of stacks
+    std::size_t size() const {
+        return offsets_.size() - 1;
+    }
+
+    // Total number of layers
+    std::size_t layer_count() const {
+        return thicknesses_.size();
+    }
+
+    StackView operator[](std::size_t s) const {
+        return StackView(thicknesses_.data() + offsets_[s],
+                         refractiveIndices_.data() + offsets_[s],
+                         offsets_[s + 1] - offsets_[s]);
+    }
+
+    // The layers of the stack s are at offsets()[s] ... offsets()[s + 1] - 1
+    const std::vector<std::size_t> &offsets() const {
+        return offsets_;
+    }
+    const std::vector<double> &thicknesses() const {
+        return thicknesses_;
+    }
+    const std::vector<complex> &refractiveIndices() const {
+        return refractiveIndices_;
+    }
+
+private:
+    std::vector<std::size_t> offsets_;
+    std::vector<double> thicknesses_;
+    std::vector<complex> refractiveIndices_;
 };
 
-struct Matrix22 {
-    Matrix22() {
+// Stacks packed like in a StackArena, in arrays owned by the caller
+//
+// The layers of the stack s are at offsets[s] ... offsets[s + 1] - 1, offsets
+// holds count + 1 values.
+struct StackArenaView {
+    StackArenaView(const std::size_t *offsets, std::size_t count,
+                   const double *thicknesses, const complex *refractiveIndices)
+        : offsets(offsets), count(count), thicknesses(thicknesses),
+          refractiveIndices(refractiveIndices) {
     }
-    Matrix22(complex m11, complex m12, complex m21, complex m22)
+
+    std::size_t size() const {
+        return count;
+    }
+
+    StackView operator[](std::size_t s) const {
+        return StackView(thicknesses + offsets[s], refractiveIndices + offsets[s],
+                         offsets[s + 1] - offsets[s]);
+    }
+
+    const std::size_t *offsets;
+    std::size_t count;
+    const double *thicknesses;
+    const complex *refractiveIndices;
+};
+
+template <class T>
+struct BasicMatrix22 {
+    typedef std::complex<T> complex_type;
+
+    BasicMatrix22() {
+    }
+    BasicMatrix22(complex_type m11, complex_type m12, complex_type m21, complex_type m22)
         : m11(m11), m12(m12), m21(m21), m22(m22) {
     }
 
-    Matrix22 &operator*=(const Matrix22 &b) {
-        complex x = m11 * b.m11 + m12 * b.m21;
+    BasicMatrix22 &operator*=(const BasicMatrix22 &b) {
+        complex_type x = m11 * b.m11 + m12 * b.m21;
         m12 = m11 * b.m12 + m12 * b.m22;
         m11 = x;
         x = m21 * b.m11 + m22 * b.m21;
@@ -38,7 +179,7 @@ struct Matrix22 {
         return *this;
     }
 
-    Matrix22 &operator/=(complex b) {
+    BasicMatrix22 &operator/=(complex_type b) {
         m11 /= b;
         m12 /= b;
         m21 /= b;
@@ -51,95 +192,598 @@ struct Matrix22 {
         (           )
         ( m21   m22 )
      */
-    complex m11;
-    complex m12;
-    complex m21;
-    complex m22;
+    complex_type m11;
+    complex_type m12;
+    complex_type m21;
+    complex_type m22;
 };
 
-const Matrix22 operator*(Matrix22 a, const Matrix22 &b) {
+typedef BasicMatrix22<double> Matrix22;
+
+template <class T>
+const BasicMatrix22<T> operator*(BasicMatrix22<T> a, const BasicMatrix22<T> &b) {
     return a *= b;
 }
 
-std::pair<Matrix22, Matrix22> transfer_matrix_PS(complex incidentCosTheta, complex nIncident,
-                                                 complex nExit, const std::vector<Layer> &layers) {
+// Scalar type of the layers of a stack, double for a std::vector<Layer>
+template <class Stack>
+using StackScalar = typename std::decay<decltype(std::declval<const Stack &>()[0].thickness)>::type;
+
+template <class Stack>
+using StackComplex = std::complex<StackScalar<Stack> >;
+
+// cos(z) and sin(z) together
+//
+// With z = x + iy
+//     cos(z) = cos(x) cosh(y) - i sin(x) sinh(y)
+//     sin(z) = sin(x) cosh(y) + i cos(x) sinh(y)
+// the real sin(x), cos(x) and the exponential are shared between the two
+// results, and a real phase (lossless layer) only costs the real sincos.
+template <class T>
+void sincos(std::complex<T> z, std::complex<T> *c, std::complex<T> *s) {
+    T x = z.real();
+    T y = z.imag();
+    T sinX = std::sin(x);
+    T cosX = std::cos(x);
+
+    if (y == T(0)) {
+        *c = std::complex<T>(cosX, T(0));
+        *s = std::complex<T>(sinX, T(0));
+        return;
+    }
+
+    // exp(|y|) = 1 + u, keeps sinh(y) accurate for small y
+    // |y| is clamped to 700 (88 in float) as in the SIMD coshsinh
+    const T maximum = sizeof(T) == sizeof(float) ? T(88) : T(700);
+    T u = std::expm1(std::min(std::fabs(y), maximum));
+    T inverseExp = T(1) / (T(1) + u);
+    T coshY = T(0.5) * (T(1) + u + inverseExp);
+    // (exp(|y|) - exp(-|y|)) / 2 without forming u (2 + u)
+    T sinhY = std::copysign(T(0.5) * (u + u * inverseExp), y);
+
+    *c = std::complex<T>(cosX * coshY, -sinX * sinhY);
+    *s = std::complex<T>(sinX * coshY, cosX * sinhY);
+}
+
+// Incident medium matrices A_0p and A_0s, see README.md
+template <class T>
+void incident_matrices_PS(std::complex<T> incidentCosTheta, std::complex<T> nIncident,
+                          BasicMatrix22<T> *MatP, BasicMatrix22<T> *MatS) {
+    const std::complex<T> one(1);
+    *MatP = BasicMatrix22<T>(nIncident, incidentCosTheta, nIncident, -incidentCosTheta);
+    *MatP /= T(2) * nIncident * incidentCosTheta;
+    *MatS = BasicMatrix22<T>(nIncident * incidentCosTheta, one, nIncident * incidentCosTheta,
+                             -one);
+    *MatS /= T(2) * nIncident * incidentCosTheta;
+}
+
+// Layer matrices C_p and C_s, see README.md
+// nSinThetaSquared = (nIncident * incidentSinTheta)^2 is conserved in the stack
+// phaseScale = 2 pi * thickness / wavelength
+template <class T>
+void layer_matrices_PS(std::complex<T> n, std::complex<T> nSinThetaSquared, T phaseScale,
+                       BasicMatrix22<T> *CP, BasicMatrix22<T> *CS) {
+    std::complex<T> cosTheta = std::sqrt(T(1) - nSinThetaSquared / (n * n));
+
+    std::complex<T> deltaLayer = phaseScale * n * cosTheta;
+    std::complex<T> c, s;
+    sincos(deltaLayer, &c, &s);
+
+    const std::complex<T> j(0, 1);
+    *CP = BasicMatrix22<T>(c, -j * s * cosTheta / n, -j * s * n / cosTheta, c);
+    *CS = BasicMatrix22<T>(c, -j * s / cosTheta / n, -j * s * n * cosTheta, c);
+}
+
+// Multiply by the layer matrices C_p and C_s, see layer_matrices_PS
+template <class T>
+void multiply_layer_PS(std::complex<T> n, std::complex<T> nSinThetaSquared, T phaseScale,
+                       BasicMatrix22<T> *MatP, BasicMatrix22<T> *MatS) {
+    BasicMatrix22<T> CP, CS;
+    layer_matrices_PS(n, nSinThetaSquared, phaseScale, &CP, &CS);
+    *MatP *= CP;
+    *MatS *= CS;
+}
+
+// Multiply by the exit medium matrices B_p and B_s, see README.md
+// returns the cosine of the angle in the exit medium
+template <class T>
+std::complex<T> multiply_exit_PS(std::complex<T> nSinThetaSquared, std::complex<T> nExit,
+                                 BasicMatrix22<T> *MatP, BasicMatrix22<T> *MatS) {
+    const std::complex<T> one(1);
+    std::complex<T> exitCosTheta = std::sqrt(T(1) - nSinThetaSquared / (nExit * nExit));
+
+    *MatP *= BasicMatrix22<T>(exitCosTheta, exitCosTheta, nExit, -nExit);
+    *MatS *= BasicMatrix22<T>(one, one, nExit * exitCosTheta, -nExit * exitCosTheta);
+    return exitCosTheta;
+}
+
+// Power coefficients from the total transfer matrices
+template <class T>
+void power_coefficients_PS(const BasicMatrix22<T> &MatP, const BasicMatrix22<T> &MatS,
+                           std::complex<T> incidentCosTheta, std::complex<T> nIncident,
+                           std::complex<T> exitCosTheta, std::complex<T> nExit,
+                           T *reflectanceP, T *reflectanceS,
+                           T *transmittanceP, T *transmittanceS) {
+    std::complex<T> rP = MatP.m21 / MatP.m11;
+    std::complex<T> rS = MatS.m21 / MatS.m11;
+
+    std::complex<T> tP = T(1) / MatP.m11;
+    std::complex<T> tS = T(1) / MatS.m11;
+
+    *reflectanceP = std::norm(rP);
+    *reflectanceS = std::norm(rS);
+
+    *transmittanceP = std::norm(tP) * std::real(nExit * std::conj(exitCosTheta)) /
+                      std::real(nIncident * std::conj(incidentCosTheta));
+    *transmittanceS = std::norm(tS) * std::real(nExit * exitCosTheta) /
+                      std::real(nIncident * incidentCosTheta);
+}
+
+// The stack entry points take the scalar type T of the layers of the stack,
+// the complex arguments and the outputs are in the same precision
+template <class Stack>
+std::pair<BasicMatrix22<StackScalar<Stack> >, BasicMatrix22<StackScalar<Stack> > >
+transfer_matrix_PS(StackComplex<Stack> incidentCosTheta, StackComplex<Stack> nIncident,
+                   StackComplex<Stack> nExit, const Stack &layers) {
     // nIncident * incidentSinTheta MUST be real, see
     // https://arxiv.org/abs/1603.02720
+    typedef StackScalar<Stack> T;
+    THINFILM_COUNT(Evaluations, 1);
+    THINFILM_COUNT(LayerEvaluations, layers.size());
+    THINFILM_TIMER(timer);
 
-    Matrix22 MatP(nIncident, incidentCosTheta, nIncident, -incidentCosTheta);
-    MatP /= 2.0 * nIncident * incidentCosTheta;
-    Matrix22 MatS(nIncident * incidentCosTheta, 1.0, nIncident * incidentCosTheta,
-                  -1.0);
-    MatS /= 2.0 * nIncident * incidentCosTheta;
+    BasicMatrix22<T> MatP, MatS;
+    incident_matrices_PS(incidentCosTheta, nIncident, &MatP, &MatS);
+
+    std::complex<T> nSinThetaSquared = (T(1) - incidentCosTheta * incidentCosTheta) *
+                                       (nIncident * nIncident);
+    THINFILM_LAP(timer, Setup);
 
     for (std::size_t i = 0; i < layers.size(); ++i) {
-        complex n = layers[i].refractiveIndex;
-        complex cosTheta = std::sqrt(1.0 -
-                                     (1.0 - incidentCosTheta * incidentCosTheta) *
-                                     (nIncident * nIncident) / (n * n));
+        multiply_layer_PS(layers[i].refractiveIndex, nSinThetaSquared,
+                          T(2.0 * M_PI) * layers[i].thickness, &MatP, &MatS);
+    }
+    THINFILM_LAP(timer, LayerLoop);
+
+    multiply_exit_PS(nSinThetaSquared, nExit, &MatP, &MatS);
+    THINFILM_LAP(timer, Output);
+
+    return std::pair<BasicMatrix22<T>, BasicMatrix22<T> >(MatP, MatS);
+}
 
-        complex deltaLayer = 2.0 * M_PI * n * layers[i].thickness * cosTheta;
-        complex c = std::cos(deltaLayer);
-        complex s = std::sin(deltaLayer);
+// Polarizations computed by transfer
+enum class Pol { P, S, PS };
 
-        const complex j(0.0, 1.0);
-        MatP *= Matrix22(c, -j * s * cosTheta / n, -j * s * n / cosTheta, c);
-        MatS *= Matrix22(c, -j * s / cosTheta / n, -j * s * n * cosTheta, c);
+// Power coefficients computed by transfer
+enum class Output { ReflectanceOnly, ReflectanceTransmittance };
+
+// First column of a transfer matrix
+template <class T>
+struct BasicColumn2 {
+    typedef std::complex<T> complex_type;
+
+    BasicColumn2() {
+    }
+    BasicColumn2(complex_type m11, complex_type m21)
+        : m11(m11), m21(m21) {
+    }
+
+    // *this = ( c    x12 ) * *this
+    //         ( x21  c   )
+    void left_multiply_layer(complex_type c, complex_type x12, complex_type x21) {
+        complex_type x = c * m11 + x12 * m21;
+        m21 = x21 * m11 + c * m21;
+        m11 = x;
+    }
+
+    complex_type m11;
+    complex_type m21;
+};
+
+typedef BasicColumn2<double> Column2;
+
+// Reflectance (and transmittance) of the polarizations selected by pol
+//
+// r = m21 / m11 and t = 1 / m11 only need the first column of the transfer
+// matrix, so it is carried from the exit medium back to the incident medium
+// as a 2-vector instead of building the 2x2 products. The unused polarization
+// and the transmittance with Output::ReflectanceOnly are compiled out, their
+// outputs are not written and may be null.
+template <Pol pol, Output output, class Stack>
+void transfer(StackComplex<Stack> incidentCosTheta, StackComplex<Stack> nIncident,
+              StackComplex<Stack> nExit, const Stack &layers,
+              StackScalar<Stack> *reflectanceP, StackScalar<Stack> *reflectanceS,
+              StackScalar<Stack> *transmittanceP, StackScalar<Stack> *transmittanceS) {
+    // nIncident * incidentSinTheta MUST be real, see
+    // https://arxiv.org/abs/1603.02720
+    typedef StackScalar<Stack> T;
+    typedef std::complex<T> C;
+
+    const bool withP = pol != Pol::S;
+    const bool withS = pol != Pol::P;
+    const bool withT = output == Output::ReflectanceTransmittance;
+    THINFILM_COUNT(Evaluations, 1);
+    THINFILM_COUNT(LayerEvaluations, layers.size());
+    THINFILM_TIMER(timer);
+
+    C nSinThetaSquared = (T(1) - incidentCosTheta * incidentCosTheta) * (nIncident * nIncident);
+    C exitCosTheta = std::sqrt(T(1) - nSinThetaSquared / (nExit * nExit));
+
+    // first columns of B_p and B_s
+    BasicColumn2<T> vP(exitCosTheta, nExit);
+    BasicColumn2<T> vS(T(1), nExit * exitCosTheta);
+    THINFILM_LAP(timer, Setup);
+
+    for (std::size_t i = layers.size(); i-- > 0;) {
+        C n = layers[i].refractiveIndex;
+        C cosTheta = std::sqrt(T(1) - nSinThetaSquared / (n * n));
+
+        C deltaLayer = T(2.0 * M_PI) * n * layers[i].thickness * cosTheta;
+        C c, s;
+        sincos(deltaLayer, &c, &s);
+        C js = C(0, -1) * s;
+
+        if (withP) {
+            vP.left_multiply_layer(c, js * cosTheta / n, js * n / cosTheta);
+        }
+        if (withS) {
+            vS.left_multiply_layer(c, js / cosTheta / n, js * n * cosTheta);
+        }
     }
 
-    complex exitCosTheta =
-        std::sqrt(1.0 -
-                  (1.0 - incidentCosTheta * incidentCosTheta) *
-                  (nIncident * nIncident) / (nExit * nExit));
+    THINFILM_LAP(timer, LayerLoop);
 
-    MatP *= Matrix22(exitCosTheta, exitCosTheta, nExit, -nExit);
-    MatS *= Matrix22(1.0, 1.0, nExit * exitCosTheta, -nExit * exitCosTheta);
+    // left multiply by A_0p and A_0s
+    C scale = T(2) * nIncident * incidentCosTheta;
 
-    return std::pair<Matrix22, Matrix22>(MatP, MatS);
+    if (withP) {
+        C m11 = (nIncident * vP.m11 + incidentCosTheta * vP.m21) / scale;
+        C m21 = (nIncident * vP.m11 - incidentCosTheta * vP.m21) / scale;
+
+        *reflectanceP = std::norm(m21 / m11);
+        if (withT) {
+            *transmittanceP = std::norm(T(1) / m11) * std::real(nExit * std::conj(exitCosTheta)) /
+                              std::real(nIncident * std::conj(incidentCosTheta));
+        }
+    }
+    if (withS) {
+        C m11 = (nIncident * incidentCosTheta * vS.m11 + vS.m21) / scale;
+        C m21 = (nIncident * incidentCosTheta * vS.m11 - vS.m21) / scale;
+
+        *reflectanceS = std::norm(m21 / m11);
+        if (withT) {
+            *transmittanceS = std::norm(T(1) / m11) * std::real(nExit * exitCosTheta) /
+                              std::real(nIncident * incidentCosTheta);
+        }
+    }
+    THINFILM_LAP(timer, Output);
 }
 
-void reflectance_transmittance(complex incidentCosTheta, complex nIncident,
-                               complex nExit, const std::vector<Layer> &layers,
-                               double *reflectanceP, double *reflectanceS,
-                               double *transmittanceP, double *transmittanceS) {
+template <class Stack>
+void reflectance_transmittance(StackComplex<Stack> incidentCosTheta, StackComplex<Stack> nIncident,
+                               StackComplex<Stack> nExit, const Stack &layers,
+                               StackScalar<Stack> *reflectanceP, StackScalar<Stack> *reflectanceS,
+                               StackScalar<Stack> *transmittanceP, StackScalar<Stack> *transmittanceS) {
 
-    std::pair<Matrix22, Matrix22> matricies = transfer_matrix_PS(incidentCosTheta, nIncident, nExit, layers);
-    Matrix22 MatP = matricies.first;
-    Matrix22 MatS = matricies.second;
+    transfer<Pol::PS, Output::ReflectanceTransmittance>(incidentCosTheta, nIncident, nExit, layers,
+                                                        reflectanceP, reflectanceS,
+                                                        transmittanceP, transmittanceS);
+}
 
-    complex rP = MatP.m21 / MatP.m11;
-    complex rS = MatS.m21 / MatS.m11;
+template <class Stack>
+void reflectance(StackComplex<Stack> incidentCosTheta, StackComplex<Stack> nIncident,
+                 StackComplex<Stack> nExit, const Stack &layers,
+                 StackScalar<Stack> *reflectanceP, StackScalar<Stack> *reflectanceS) {
+    typedef StackScalar<Stack> T;
 
-    complex tP = 1.0 / MatP.m11;
-    complex tS = 1.0 / MatS.m11;
+    transfer<Pol::PS, Output::ReflectanceOnly>(incidentCosTheta, nIncident, nExit, layers,
+                                               reflectanceP, reflectanceS, (T *)0, (T *)0);
+}
 
-    *reflectanceP = std::norm(rP);
-    *reflectanceS = std::norm(rS);
+// Fresnel coefficients of the interface from the medium 1 to the medium 2,
+// with the conventions of the transfer matrices: r = m21 / m11, t = 1 / m11
+template <class T>
+void interface_coefficients_PS(std::complex<T> n1, std::complex<T> cos1,
+                               std::complex<T> n2, std::complex<T> cos2,
+                               std::complex<T> *rP, std::complex<T> *rS,
+                               std::complex<T> *tP, std::complex<T> *tS) {
+    std::complex<T> denominatorP = n1 * cos2 + n2 * cos1;
+    std::complex<T> denominatorS = n1 * cos1 + n2 * cos2;
+    *rP = (n1 * cos2 - n2 * cos1) / denominatorP;
+    *rS = (n1 * cos1 - n2 * cos2) / denominatorS;
+    *tP = T(2) * n1 * cos1 / denominatorP;
+    *tS = T(2) * n1 * cos1 / denominatorS;
+}
 
-    complex exitCosTheta =
-        std::sqrt(1.0 -
-                  (1.0 - incidentCosTheta * incidentCosTheta) *
-                  (nIncident * nIncident) / (nExit * nExit));
+// Same as reflectance_transmittance, stable for thick absorbing layers and
+// evanescent waves
+//
+// The amplitude coefficients r and t of the stack behind every interface are
+// accumulated from the exit medium back to the incident medium
+//
+//     r = (r12 + r' psi^2) / (1 + r12 r' psi^2)
+//     t = t12 t' psi / (1 + r12 r' psi^2)
+//
+// where r', t' are the coefficients behind the layer 2 and psi its propagation
+// factor, taken on the decaying branch |psi| <= 1. Nothing grows along the
+// stack, so double precision holds where the transfer matrices overflow.
+template <class Stack>
+void scattering_reflectance_transmittance(StackComplex<Stack> incidentCosTheta,
+                                          StackComplex<Stack> nIncident,
+                                          StackComplex<Stack> nExit, const Stack &layers,
+                                          StackScalar<Stack> *reflectanceP,
+                                          StackScalar<Stack> *reflectanceS,
+                                          StackScalar<Stack> *transmittanceP,
+                                          StackScalar<Stack> *transmittanceS) {
+    // nIncident * incidentSinTheta MUST be real, see
+    // https://arxiv.org/abs/1603.02720
+    typedef StackScalar<Stack> T;
+    typedef std::complex<T> C;
+    THINFILM_COUNT(Evaluations, 1);
+    THINFILM_COUNT(LayerEvaluations, layers.size());
+
+    C nSinThetaSquared = (T(1) - incidentCosTheta * incidentCosTheta) * (nIncident * nIncident);
+    C exitCosTheta = std::sqrt(T(1) - nSinThetaSquared / (nExit * nExit));
+
+    // coefficients behind the medium 2, nothing behind the exit medium
+    C rP(0), rS(0), tP(1), tS(1);
+    C n2 = nExit;
+    C cos2 = exitCosTheta;
+    C psi(1);
+
+    const C j(0, 1);
+    for (std::size_t i = layers.size() + 1; i-- > 0;) {
+        C n1 = i > 0 ? layers[i - 1].refractiveIndex : nIncident;
+        C cos1 = incidentCosTheta;
+        if (i > 0) {
+            cos1 = std::sqrt(T(1) - nSinThetaSquared / (n1 * n1));
+            // the decaying wave, the result does not depend on the branch
+            if (std::imag(n1 * cos1) < T(0)) {
+                cos1 = -cos1;
+            }
+        }
+
+        C r12P, r12S, t12P, t12S;
+        interface_coefficients_PS(n1, cos1, n2, cos2, &r12P, &r12S, &t12P, &t12S);
+
+        C psi2 = psi * psi;
+        C denominatorP = T(1) + r12P * rP * psi2;
+        C denominatorS = T(1) + r12S * rS * psi2;
+        rP = (r12P + rP * psi2) / denominatorP;
+        rS = (r12S + rS * psi2) / denominatorS;
+        tP = t12P * tP * psi / denominatorP;
+        tS = t12S * tS * psi / denominatorS;
+
+        if (i > 0) {
+            psi = std::exp(j * (T(2.0 * M_PI) * layers[i - 1].thickness) * n1 * cos1);
+        }
+        n2 = n1;
+        cos2 = cos1;
+    }
 
+    *reflectanceP = std::norm(rP);
+    *reflectanceS = std::norm(rS);
     *transmittanceP = std::norm(tP) * std::real(nExit * std::conj(exitCosTheta)) /
                       std::real(nIncident * std::conj(incidentCosTheta));
     *transmittanceS = std::norm(tS) * std::real(nExit * exitCosTheta) /
                       std::real(nIncident * incidentCosTheta);
 }
 
-void reflectance(complex incidentCosTheta, complex nIncident, complex nExit,
-                 const std::vector<Layer> &layers, double *reflectanceP,
-                 double *reflectanceS) {
+// Evaluation method of reflectance_transmittance
+enum class Engine {
+    // transfer matrices, the fastest
+    TransferMatrix,
+    // scattering_reflectance_transmittance, stable
+    ScatteringMatrix,
+    // the scattering engine when the transfer matrices would lose precision
+    Auto
+};
+
+// Sum of |Im(delta)| over the layers, the transfer matrices grow as exp(growth)
+template <class Stack>
+StackScalar<Stack> transfer_growth(StackComplex<Stack> incidentCosTheta, StackComplex<Stack> nIncident,
+                                   const Stack &layers) {
+    typedef StackScalar<Stack> T;
+    std::complex<T> nSinThetaSquared = (T(1) - incidentCosTheta * incidentCosTheta) *
+                                       (nIncident * nIncident);
+    T growth = 0;
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        std::complex<T> n = layers[i].refractiveIndex;
+        std::complex<T> cosTheta = std::sqrt(T(1) - nSinThetaSquared / (n * n));
+        growth += std::fabs(std::imag(T(2.0 * M_PI) * layers[i].thickness * n * cosTheta));
+    }
+    return growth;
+}
+
+// reflectance_transmittance with the choice of the engine
+//
+// Engine::Auto takes the scattering engine once exp(2 growth) exceeds
+// the precision of T, the check costs one square root per layer
+template <class Stack>
+void reflectance_transmittance(StackComplex<Stack> incidentCosTheta, StackComplex<Stack> nIncident,
+                               StackComplex<Stack> nExit, const Stack &layers,
+                               StackScalar<Stack> *reflectanceP, StackScalar<Stack> *reflectanceS,
+                               StackScalar<Stack> *transmittanceP, StackScalar<Stack> *transmittanceS,
+                               Engine engine) {
+    typedef StackScalar<Stack> T;
+
+    if (engine == Engine::Auto) {
+        const T maximumGrowth = T(-0.5) * std::log(std::numeric_limits<T>::epsilon());
+        engine = transfer_growth(incidentCosTheta, nIncident, layers) > maximumGrowth
+                     ? Engine::ScatteringMatrix
+                     : Engine::TransferMatrix;
+        if (engine == Engine::ScatteringMatrix) {
+            THINFILM_COUNT(ScatteringFallbacks, 1);
+        }
+    }
 
-    std::pair<Matrix22, Matrix22> matricies = transfer_matrix_PS(incidentCosTheta, nIncident, nExit, layers);
-    Matrix22 MatP = matricies.first;
-    Matrix22 MatS = matricies.second;
+    if (engine == Engine::ScatteringMatrix) {
+        scattering_reflectance_transmittance(incidentCosTheta, nIncident, nExit, layers,
+                                             reflectanceP, reflectanceS,
+                                             transmittanceP, transmittanceS);
+    } else {
+        reflectance_transmittance(incidentCosTheta, nIncident, nExit, layers,
+                                  reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+    }
+}
 
-    complex rP = MatP.m21 / MatP.m11;
-    complex rS = MatS.m21 / MatS.m11;
+// Copy of a stack in the precision U, e.g. to refine in double the candidates
+// screened in float
+template <class U, class Stack>
+std::vector<BasicLayer<U> > stack_cast(const Stack &layers) {
+    std::vector<BasicLayer<U> > result(layers.size());
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        result[i].thickness = U(layers[i].thickness);
+        result[i].refractiveIndex = std::complex<U>(layers[i].refractiveIndex);
+    }
+    return result;
+}
 
-    *reflectanceP = std::norm(rP);
-    *reflectanceS = std::norm(rS);
+// Explicit instantiations of the stack entry points for std::vector<Layer> and
+// StackView, compiled once in thinfilm_lib.cc. A translation unit that
+// defines THINFILM_EXTERN_TEMPLATES links against them instead of
+// instantiating them, the other stacks are instantiated as usual.
+#define THINFILM_INSTANTIATE(prefix, Stack)                                                  \
+    prefix std::pair<Matrix22, Matrix22> transfer_matrix_PS<Stack>(complex, complex, complex, \
+                                                                   const Stack &);           \
+    prefix void reflectance_transmittance<Stack>(complex, complex, complex, const Stack &,    \
+                                                 double *, double *, double *, double *);    \
+    prefix void reflectance_transmittance<Stack>(complex, complex, complex, const Stack &,    \
+                                                 double *, double *, double *, double *,     \
+                                                 Engine);                                    \
+    prefix void reflectance<Stack>(complex, complex, complex, const Stack &,                  \
+                                   double *, double *);                                      \
+    prefix void scattering_reflectance_transmittance<Stack>(complex, complex, complex,        \
+                                                            const Stack &, double *,          \
+                                                            double *, double *, double *);
+
+#ifdef THINFILM_EXTERN_TEMPLATES
+THINFILM_INSTANTIATE(extern template, std::vector<Layer>)
+THINFILM_INSTANTIATE(extern template, StackView)
+#endif
+
+// Spectral sweep of a stack over wavelengthCount wavelengths
+//
+// thicknesses[i] is the physical thickness of the layer i < layerCount,
+// expressed in the same unit as the wavelengths
+// refractiveIndices[i * wavelengthCount + k] is the refractive index of the
+// layer i at wavelengths[k]
+// nIncident[k] and nExit[k] are the indices of the media at wavelengths[k],
+// nIncident[k] * incidentSinTheta MUST be real
+// The outputs are arrays of wavelengthCount values
+inline void spectral_reflectance_transmittance(complex incidentCosTheta,
+                                               const complex *nIncident, const complex *nExit,
+                                               const double *thicknesses, std::size_t layerCount,
+                                               const complex *refractiveIndices,
+                                               const double *wavelengths, std::size_t wavelengthCount,
+                                               double *reflectanceP, double *reflectanceS,
+                                               double *transmittanceP, double *transmittanceS) {
+    THINFILM_COUNT(Sweeps, 1);
+    THINFILM_COUNT(Evaluations, wavelengthCount);
+    THINFILM_COUNT(LayerEvaluations, layerCount * wavelengthCount);
+    THINFILM_TIMER(timer);
+
+    complex incidentSinThetaSquared = 1.0 - incidentCosTheta * incidentCosTheta;
+
+    for (std::size_t k = 0; k < wavelengthCount; ++k) {
+        Matrix22 MatP, MatS;
+        incident_matrices_PS(incidentCosTheta, nIncident[k], &MatP, &MatS);
+
+        complex nSinThetaSquared = incidentSinThetaSquared * (nIncident[k] * nIncident[k]);
+        double waveNumber = 2.0 * M_PI / wavelengths[k];
+        THINFILM_LAP(timer, Setup);
+
+        const complex *n = refractiveIndices + k;
+        for (std::size_t i = 0; i < layerCount; ++i, n += wavelengthCount) {
+            multiply_layer_PS(*n, nSinThetaSquared, waveNumber * thicknesses[i],
+                              &MatP, &MatS);
+        }
+        THINFILM_LAP(timer, LayerLoop);
+
+        complex exitCosTheta = multiply_exit_PS(nSinThetaSquared, nExit[k], &MatP, &MatS);
+
+        power_coefficients_PS(MatP, MatS, incidentCosTheta, nIncident[k], exitCosTheta, nExit[k],
+                              reflectanceP + k, reflectanceS + k,
+                              transmittanceP + k, transmittanceS + k);
+        THINFILM_LAP(timer, Output);
+    }
+}
+
+// Quantities of a layer that do not depend on the incidence angle
+struct LayerInvariants {
+    LayerInvariants() {
+    }
+    explicit LayerInvariants(const Layer &layer)
+        : n(layer.refractiveIndex), inverseN(1.0 / n), inverseNSquared(inverseN * inverseN),
+          phase(2.0 * M_PI * n * layer.thickness) {
+    }
+
+    complex n;
+    complex inverseN;
+    complex inverseNSquared;
+    // 2 pi n thickness
+    complex phase;
+};
+
+// Multiply by the layer matrices C_p and C_s using the precomputed invariants
+inline void multiply_layer_PS(const LayerInvariants &layer, complex nSinThetaSquared,
+                              Matrix22 *MatP, Matrix22 *MatS) {
+    complex cosTheta = std::sqrt(1.0 - nSinThetaSquared * layer.inverseNSquared);
+    complex inverseCosTheta = 1.0 / cosTheta;
+
+    complex deltaLayer = layer.phase * cosTheta;
+    complex c, s;
+    sincos(deltaLayer, &c, &s);
+    complex js = complex(0.0, -1.0) * s;
+
+    *MatP *= Matrix22(c, js * cosTheta * layer.inverseN, js * layer.n * inverseCosTheta, c);
+    *MatS *= Matrix22(c, js * inverseCosTheta * layer.inverseN, js * layer.n * cosTheta, c);
+}
+
+// Angular sweep of a stack over angleCount incidence angles
+//
+// The angle independent quantities of the layers are computed once, then
+// every incidentCosTheta[k] only costs the layer matrix products.
+// nIncident * incidentSinTheta MUST be real
+// The outputs are arrays of angleCount values
+template <class Stack>
+void angular_reflectance_transmittance(const complex *incidentCosTheta, std::size_t angleCount,
+                                       complex nIncident, complex nExit,
+                                       const Stack &layers,
+                                       double *reflectanceP, double *reflectanceS,
+                                       double *transmittanceP, double *transmittanceS) {
+    THINFILM_COUNT(Sweeps, 1);
+    THINFILM_COUNT(Evaluations, angleCount);
+    THINFILM_COUNT(LayerEvaluations, layers.size() * angleCount);
+    THINFILM_TIMER(timer);
+
+    std::vector<LayerInvariants> invariants(layers.size());
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        invariants[i] = LayerInvariants(layers[i]);
+    }
+    complex nIncidentSquared = nIncident * nIncident;
+    THINFILM_LAP(timer, Setup);
+
+    for (std::size_t k = 0; k < angleCount; ++k) {
+        Matrix22 MatP, MatS;
+        incident_matrices_PS(incidentCosTheta[k], nIncident, &MatP, &MatS);
+
+        complex nSinThetaSquared = (1.0 - incidentCosTheta[k] * incidentCosTheta[k]) *
+                                   nIncidentSquared;
+        THINFILM_LAP(timer, Setup);
+
+        for (std::size_t i = 0; i < invariants.size(); ++i) {
+            multiply_layer_PS(invariants[i], nSinThetaSquared, &MatP, &MatS);
+        }
+        THINFILM_LAP(timer, LayerLoop);
+
+        complex exitCosTheta = multiply_exit_PS(nSinThetaSquared, nExit, &MatP, &MatS);
+
+        power_coefficients_PS(MatP, MatS, incidentCosTheta[k], nIncident, exitCosTheta, nExit,
+                              reflectanceP + k, reflectanceS + k,
+                              transmittanceP + k, transmittanceS + k);
+        THINFILM_LAP(timer, Output);
+    }
 }
 
 }
@@ -41,3 +41,123 @@ def compute(incidentCosTheta, nIncident, nExit, layers):
     transmittanceS = abs(tS)**2 * (nExit * exitCosTheta).real / (nIncident * incidentCosTheta).real
 
     return reflectanceP, reflectanceS, transmittanceP, transmittanceS
+
+
+# Bindings of the C++ sweeps, see thinfilm_python.cc
+#
+# The library is libthinfilm_python.so next to this file, or the file named by
+# the environment variable THINFILM_LIBRARY. The arrays are passed to C++
+# without copy when they are C contiguous float64 (complex128 for the indices
+# and the cosines), the results are written in the arrays of out if given.
+# ctypes releases the GIL during the computation.
+
+import ctypes
+import os
+
+_library = None
+
+def _lib():
+    global _library
+    if _library is None:
+        path = os.environ.get('THINFILM_LIBRARY',
+                              os.path.join(os.path.dirname(os.path.abspath(__file__)), 'libthinfilm_python.so'))
+        lib = ctypes.CDLL(path)
+        P, D, N = ctypes.c_void_p, ctypes.c_double, ctypes.c_size_t
+
+        lib.thinfilm_simd_path.argtypes = []
+        lib.thinfilm_simd_path.restype = ctypes.c_char_p
+        lib.thinfilm_thread_count.argtypes = []
+        lib.thinfilm_thread_count.restype = N
+        lib.thinfilm_spectral_reflectance_transmittance.argtypes = [D, D, P, P, P, N, P, P, N, P, P, P, P]
+        lib.thinfilm_spectral_reflectance_transmittance.restype = None
+        lib.thinfilm_angular_reflectance_transmittance.argtypes = [P, N, D, D, D, D, P, P, N, P, P, P, P]
+        lib.thinfilm_angular_reflectance_transmittance.restype = None
+        lib.thinfilm_batch_reflectance_transmittance.argtypes = [D, D, D, D, P, N, P, P, P, N, P, N, P, P, P, P]
+        lib.thinfilm_batch_reflectance_transmittance.restype = None
+        _library = lib
+    return _library
+
+def _input(a, dtype, shape=None):
+    # the array itself when it is contiguous and of the type
+    if shape is not None:
+        a = np.broadcast_to(a, shape)
+    return np.ascontiguousarray(a, dtype=dtype)
+
+def _outputs(out, shape):
+    if out is None:
+        return tuple(np.empty(shape) for _ in range(4))
+    out = tuple(out)
+    for a in out:
+        if a.dtype != np.float64 or a.shape != shape or not a.flags.c_contiguous or not a.flags.writeable:
+            raise ValueError('out must be 4 writeable C contiguous float64 arrays of shape {}'.format(shape))
+    return out
+
+def _data(a):
+    # the caller keeps a alive during the call
+    return ctypes.c_void_p(a.ctypes.data)
+
+# Name of the instruction set of the SIMD sweeps
+def simd_path():
+    return _lib().thinfilm_simd_path().decode()
+
+# Spectral sweep of a stack, thicknesses in the unit of the wavelengths
+# refractiveIndices[i, k] is the index of the layer i at wavelengths[k] (or
+# refractiveIndices[i] at every wavelength), nIncident and nExit are scalars or
+# arrays of the wavelengths
+# Returns the arrays (reflectanceP, reflectanceS, transmittanceP, transmittanceS)
+def spectral_reflectance_transmittance(incidentCosTheta, nIncident, nExit, thicknesses, refractiveIndices,
+                                       wavelengths, out=None):
+    wavelengths = _input(wavelengths, np.float64)
+    count = wavelengths.size
+    thicknesses = _input(thicknesses, np.float64)
+    indices = np.asarray(refractiveIndices)
+    if indices.ndim == 1:
+        indices = indices[:, np.newaxis]
+    indices = _input(indices, np.complex128, (thicknesses.size, count))
+    nIncident = _input(nIncident, np.complex128, (count,))
+    nExit = _input(nExit, np.complex128, (count,))
+    Rp, Rs, Tp, Ts = _outputs(out, (count,))
+
+    c = complex(incidentCosTheta)
+    _lib().thinfilm_spectral_reflectance_transmittance(
+        c.real, c.imag, _data(nIncident), _data(nExit), _data(thicknesses), thicknesses.size,
+        _data(indices), _data(wavelengths), count, _data(Rp), _data(Rs), _data(Tp), _data(Ts))
+    return Rp, Rs, Tp, Ts
+
+# Angular sweep of a stack, thicknesses in unit of the wavelength
+def angular_reflectance_transmittance(incidentCosTheta, nIncident, nExit, thicknesses, refractiveIndices,
+                                      out=None):
+    cosines = _input(incidentCosTheta, np.complex128)
+    count = cosines.size
+    thicknesses = _input(thicknesses, np.float64)
+    indices = _input(refractiveIndices, np.complex128, (thicknesses.size,))
+    Rp, Rs, Tp, Ts = _outputs(out, (count,))
+
+    nI, nE = complex(nIncident), complex(nExit)
+    _lib().thinfilm_angular_reflectance_transmittance(
+        _data(cosines), count, nI.real, nI.imag, nE.real, nE.imag,
+        _data(thicknesses), _data(indices), thicknesses.size, _data(Rp), _data(Rs), _data(Tp), _data(Ts))
+    return Rp, Rs, Tp, Ts
+
+# Many stacks on all the cores, the layers of the stack s are
+# offsets[s] ... offsets[s + 1] - 1 of thicknesses and refractiveIndices,
+# thicknesses in the unit of the wavelengths
+# Returns arrays of shape (stacks, wavelengths, angles)
+def batch_reflectance_transmittance(nIncident, nExit, offsets, thicknesses, refractiveIndices,
+                                    wavelengths, incidentCosTheta, out=None):
+    offsets = _input(offsets, np.uintp)
+    stackCount = offsets.size - 1
+    thicknesses = _input(thicknesses, np.float64)
+    indices = _input(refractiveIndices, np.complex128, (thicknesses.size,))
+    if stackCount < 0 or offsets[-1] > thicknesses.size or np.any(np.diff(offsets.astype(np.int64)) < 0):
+        raise ValueError('offsets must increase from 0 up to the number of layers')
+    wavelengths = _input(wavelengths, np.float64)
+    cosines = _input(incidentCosTheta, np.complex128)
+    Rp, Rs, Tp, Ts = _outputs(out, (stackCount, wavelengths.size, cosines.size))
+
+    nI, nE = complex(nIncident), complex(nExit)
+    _lib().thinfilm_batch_reflectance_transmittance(
+        nI.real, nI.imag, nE.real, nE.imag, _data(offsets), stackCount, _data(thicknesses), _data(indices),
+        _data(wavelengths), wavelengths.size, _data(cosines), cosines.size,
+        _data(Rp), _data(Rs), _data(Tp), _data(Ts))
+    return Rp, Rs, Tp, Ts
@@ -0,0 +1,259 @@
+#ifndef THINFILM_BATCH_H
+#define THINFILM_BATCH_H
+
+#include "thinfilm.hh"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Evaluation of many independent stacks on all the cores (link with -pthread)
+
+namespace thinfilm {
+
+// Persistent threads running parallel loops
+//
+// The indices of a loop are split in one contiguous range per worker. A worker
+// takes the indices at the front of its own range and, once it is empty,
+// steals the back half of the range of another worker. Running a loop does not
+// allocate.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(std::size_t threadCount = std::thread::hardware_concurrency())
+        : workers_(std::max<std::size_t>(threadCount, 1)), generation_(0), running_(0),
+          stop_(false), function_(0), context_(0) {
+        // the calling thread is the worker 0
+        for (std::size_t w = 1; w < workers_.size(); ++w) {
+            threads_.push_back(std::thread(&WorkStealingPool::thread_loop, this, w));
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (std::size_t t = 0; t < threads_.size(); ++t) {
+            threads_[t].join();
+        }
+    }
+
+    std::size_t size() const {
+        return workers_.size();
+    }
+
+    // Call f(i) for every i in [0, count), returns when all the calls are done
+    // f is called concurrently and in no particular order
+    template <class F>
+    void parallel_for(std::size_t count, F &f) {
+        run(count, &call<F>, &f);
+    }
+
+    // Same, f(w, i) also gets the index w < size() of the worker running it,
+    // for scratch buffers allocated once per worker
+    template <class F>
+    void parallel_for_worker(std::size_t count, F &f) {
+        run(count, &call_worker<F>, &f);
+    }
+
+private:
+    WorkStealingPool(const WorkStealingPool &);
+    WorkStealingPool &operator=(const WorkStealingPool &);
+
+    struct alignas(64) Worker {
+        Worker() : begin(0), end(0) {
+        }
+
+        std::mutex mutex;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    template <class F>
+    static void call(void *f, std::size_t, std::size_t i) {
+        (*static_cast<F *>(f))(i);
+    }
+
+    template <class F>
+    static void call_worker(void *f, std::size_t w, std::size_t i) {
+        (*static_cast<F *>(f))(w, i);
+    }
+
+    void run(std::size_t count, void (*function)(void *, std::size_t, std::size_t), void *context) {
+        std::lock_guard<std::mutex> serialize(run_mutex_);
+
+        std::size_t n = workers_.size();
+        for (std::size_t w = 0; w < n; ++w) {
+            std::lock_guard<std::mutex> lock(workers_[w].mutex);
+            workers_[w].begin = count * w / n;
+            workers_[w].end = count * (w + 1) / n;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            function_ = function;
+            context_ = context;
+            running_ = n - 1;
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return running_ == 0; });
+    }
+
+    void thread_loop(std::size_t w) {
+        std::size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+            }
+
+            work(w);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--running_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    void work(std::size_t w) {
+        std::size_t i;
+        while (pop(w, &i) || steal(w, &i)) {
+            function_(context_, w, i);
+        }
+    }
+
+    bool pop(std::size_t w, std::size_t *i) {
+        std::lock_guard<std::mutex> lock(workers_[w].mutex);
+        if (workers_[w].begin == workers_[w].end) {
+            return false;
+        }
+        *i = workers_[w].begin++;
+        return true;
+    }
+
+    // Move the back half of the range of another worker into the range of w
+    // and take its first index
+    bool steal(std::size_t w, std::size_t *i) {
+        std::size_t n = workers_.size();
+        for (std::size_t k = 1; k < n; ++k) {
+            Worker &victim = workers_[(w + k) % n];
+            std::size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                std::size_t remaining = victim.end - victim.begin;
+                if (remaining == 0) {
+                    continue;
+                }
+                end = victim.end;
+                begin = end - (remaining + 1) / 2;
+                victim.end = begin;
+            }
+
+            std::lock_guard<std::mutex> lock(workers_[w].mutex);
+            *i = begin;
+            workers_[w].begin = begin + 1;
+            workers_[w].end = end;
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<Worker> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::size_t generation_;
+    std::size_t running_;
+    bool stop_;
+
+    void (*function_)(void *, std::size_t, std::size_t);
+    void *context_;
+};
+
+// Reflectance and transmittance of all the stacks of an arena on a shared grid
+// of wavelengths and incidence angles
+//
+// stacks is a StackArena or a StackArenaView, stacks[s] is a StackView.
+//
+// The thicknesses of the layers of the stacks are expressed in the unit of
+// the wavelengths (use a single wavelength of 1 for thicknesses in unit of
+// wavelength).
+// nIncident * incidentSinTheta MUST be real
+// The outputs hold stacks.size() * wavelengthCount * angleCount values, the
+// result of (stack s, wavelengths[k], incidentCosTheta[a]) is written at
+// (s * wavelengthCount + k) * angleCount + a whatever thread computed it.
+template <class Stacks>
+void batch_reflectance_transmittance(WorkStealingPool &pool,
+                                     complex nIncident, complex nExit,
+                                     const Stacks &stacks,
+                                     const double *wavelengths, std::size_t wavelengthCount,
+                                     const complex *incidentCosTheta, std::size_t angleCount,
+                                     double *reflectanceP, double *reflectanceS,
+                                     double *transmittanceP, double *transmittanceS) {
+    struct Task {
+        void operator()(std::size_t s) const {
+            StackView layers = stacks[s];
+            THINFILM_COUNT(Evaluations, wavelengthCount * angleCount);
+            THINFILM_COUNT(LayerEvaluations, layers.size() * wavelengthCount * angleCount);
+
+            std::size_t out = s * wavelengthCount * angleCount;
+            for (std::size_t k = 0; k < wavelengthCount; ++k) {
+                double waveNumber = 2.0 * M_PI / wavelengths[k];
+
+                for (std::size_t a = 0; a < angleCount; ++a, ++out) {
+                    Matrix22 MatP, MatS;
+                    incident_matrices_PS(incidentCosTheta[a], nIncident, &MatP, &MatS);
+
+                    complex nSinThetaSquared = (1.0 - incidentCosTheta[a] * incidentCosTheta[a]) *
+                                               (nIncident * nIncident);
+
+                    for (std::size_t i = 0; i < layers.size(); ++i) {
+                        multiply_layer_PS(layers.refractiveIndices[i], nSinThetaSquared,
+                                          waveNumber * layers.thicknesses[i], &MatP, &MatS);
+                    }
+
+                    complex exitCosTheta = multiply_exit_PS(nSinThetaSquared, nExit, &MatP, &MatS);
+
+                    power_coefficients_PS(MatP, MatS, incidentCosTheta[a], nIncident,
+                                          exitCosTheta, nExit,
+                                          reflectanceP + out, reflectanceS + out,
+                                          transmittanceP + out, transmittanceS + out);
+                }
+            }
+        }
+
+        complex nIncident;
+        complex nExit;
+        const Stacks &stacks;
+        const double *wavelengths;
+        std::size_t wavelengthCount;
+        const complex *incidentCosTheta;
+        std::size_t angleCount;
+        double *reflectanceP;
+        double *reflectanceS;
+        double *transmittanceP;
+        double *transmittanceS;
+    };
+
+    Task task = { nIncident, nExit, stacks, wavelengths, wavelengthCount,
+                  incidentCosTheta, angleCount,
+                  reflectanceP, reflectanceS, transmittanceP, transmittanceS };
+    pool.parallel_for(stacks.size(), task);
+}
+
+}
+#endif
@@ -0,0 +1,228 @@
+/*
+   Benchmarks of the kernels, with Google Benchmark
+
+   g++ -O2 -o thinfilm_bench thinfilm_bench.cc -lbenchmark -lpthread
+
+   The SIMD sweeps choose the instruction set at run time, THINFILM_SIMD=avx2
+   or scalar limits it to compare the kernels.
+
+   The arguments are (number of layers, absorbing). The throughput is
+   reported as items_per_second where an item is the evaluation of one layer
+   at one wavelength or angle, so the kernels can be compared whatever the
+   size of the stack and of the sweep.
+ */
+#include "thinfilm.hh"
+#include "thinfilm_fixed.hh"
+#include "thinfilm_simd.hh"
+#include <benchmark/benchmark.h>
+
+using namespace std;
+
+namespace {
+
+const size_t wavelengthCount = 1024;
+
+vector<thinfilm::Layer> make_layers(size_t n, bool absorbing) {
+    vector<thinfilm::Layer> layers(n);
+    for (size_t i = 0; i < n; ++i) {
+        double index = (i % 2 == 0) ? 2.35 : 1.46;
+        layers[i].thickness = 0.25 / index * (1.0 + 0.01 * (i % 7));
+        layers[i].refractiveIndex = thinfilm::complex(index, absorbing ? 0.002 : 0.0);
+    }
+    return layers;
+}
+
+struct Sweep {
+    Sweep(size_t n, bool absorbing)
+        : thicknesses(n), refractiveIndices(n * wavelengthCount), wavelengths(wavelengthCount),
+          nIncident(wavelengthCount, 1.0), nExit(wavelengthCount, 1.52),
+          reflectanceP(wavelengthCount), reflectanceS(wavelengthCount),
+          transmittanceP(wavelengthCount), transmittanceS(wavelengthCount) {
+        vector<thinfilm::Layer> layers = make_layers(n, absorbing);
+        for (size_t k = 0; k < wavelengthCount; ++k) {
+            wavelengths[k] = 400.0 + 400.0 * k / wavelengthCount;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            thicknesses[i] = layers[i].thickness * 550.0;
+            for (size_t k = 0; k < wavelengthCount; ++k) {
+                refractiveIndices[i * wavelengthCount + k] = layers[i].refractiveIndex;
+            }
+        }
+    }
+
+    vector<double> thicknesses;
+    vector<thinfilm::complex> refractiveIndices;
+    vector<double> wavelengths;
+    vector<thinfilm::complex> nIncident;
+    vector<thinfilm::complex> nExit;
+    vector<double> reflectanceP, reflectanceS, transmittanceP, transmittanceS;
+};
+
+void layer_evaluations(benchmark::State &state, size_t points) {
+    state.SetItemsProcessed(int64_t(state.iterations()) * state.range(0) * points);
+}
+
+void BM_transfer_matrix_PS(benchmark::State &state) {
+    vector<thinfilm::Layer> layers = make_layers(state.range(0), state.range(1));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(thinfilm::transfer_matrix_PS(0.8, 1.0, 1.52, layers));
+    }
+    layer_evaluations(state, 1);
+}
+
+void BM_reflectance_transmittance(benchmark::State &state) {
+    vector<thinfilm::Layer> layers = make_layers(state.range(0), state.range(1));
+    double reflectanceP, reflectanceS, transmittanceP, transmittanceS;
+    for (auto _ : state) {
+        thinfilm::reflectance_transmittance(0.8, 1.0, 1.52, layers,
+                                            &reflectanceP, &reflectanceS,
+                                            &transmittanceP, &transmittanceS);
+        benchmark::DoNotOptimize(reflectanceP);
+        benchmark::DoNotOptimize(transmittanceS);
+    }
+    layer_evaluations(state, 1);
+}
+
+void BM_reflectance(benchmark::State &state) {
+    vector<thinfilm::Layer> layers = make_layers(state.range(0), state.range(1));
+    double reflectanceP, reflectanceS;
+    for (auto _ : state) {
+        thinfilm::reflectance(0.8, 1.0, 1.52, layers, &reflectanceP, &reflectanceS);
+        benchmark::DoNotOptimize(reflectanceP);
+        benchmark::DoNotOptimize(reflectanceS);
+    }
+    layer_evaluations(state, 1);
+}
+
+void BM_reflectance_S(benchmark::State &state) {
+    vector<thinfilm::Layer> layers = make_layers(state.range(0), state.range(1));
+    double reflectanceS;
+    for (auto _ : state) {
+        thinfilm::transfer<thinfilm::Pol::S, thinfilm::Output::ReflectanceOnly>(
+            0.8, 1.0, 1.52, layers, 0, &reflectanceS, 0, 0);
+        benchmark::DoNotOptimize(reflectanceS);
+    }
+    layer_evaluations(state, 1);
+}
+
+void BM_spectral_reflectance_transmittance(benchmark::State &state) {
+    Sweep sweep(state.range(0), state.range(1));
+    for (auto _ : state) {
+        thinfilm::spectral_reflectance_transmittance(
+            0.8, sweep.nIncident.data(), sweep.nExit.data(),
+            sweep.thicknesses.data(), sweep.thicknesses.size(), sweep.refractiveIndices.data(),
+            sweep.wavelengths.data(), wavelengthCount,
+            sweep.reflectanceP.data(), sweep.reflectanceS.data(),
+            sweep.transmittanceP.data(), sweep.transmittanceS.data());
+        benchmark::ClobberMemory();
+    }
+    layer_evaluations(state, wavelengthCount);
+}
+
+void BM_spectral_reflectance_transmittance_simd(benchmark::State &state) {
+    Sweep sweep(state.range(0), state.range(1));
+    for (auto _ : state) {
+        thinfilm::spectral_reflectance_transmittance_simd(
+            0.8, sweep.nIncident.data(), sweep.nExit.data(),
+            sweep.thicknesses.data(), sweep.thicknesses.size(), sweep.refractiveIndices.data(),
+            sweep.wavelengths.data(), wavelengthCount,
+            sweep.reflectanceP.data(), sweep.reflectanceS.data(),
+            sweep.transmittanceP.data(), sweep.transmittanceS.data());
+        benchmark::ClobberMemory();
+    }
+    layer_evaluations(state, wavelengthCount);
+}
+
+void BM_spectral_reflectance_transmittance_simd_float(benchmark::State &state) {
+    Sweep sweep(state.range(0), state.range(1));
+    vector<float> thicknesses(sweep.thicknesses.begin(), sweep.thicknesses.end());
+    vector<complex<float> > refractiveIndices(sweep.refractiveIndices.begin(), sweep.refractiveIndices.end());
+    vector<float> wavelengths(sweep.wavelengths.begin(), sweep.wavelengths.end());
+    vector<complex<float> > nIncident(sweep.nIncident.begin(), sweep.nIncident.end());
+    vector<complex<float> > nExit(sweep.nExit.begin(), sweep.nExit.end());
+    vector<float> reflectanceP(wavelengthCount), reflectanceS(wavelengthCount);
+    vector<float> transmittanceP(wavelengthCount), transmittanceS(wavelengthCount);
+    for (auto _ : state) {
+        thinfilm::spectral_reflectance_transmittance_simd(
+            complex<float>(0.8f), nIncident.data(), nExit.data(),
+            thicknesses.data(), thicknesses.size(), refractiveIndices.data(),
+            wavelengths.data(), wavelengthCount,
+            reflectanceP.data(), reflectanceS.data(),
+            transmittanceP.data(), transmittanceS.data());
+        benchmark::ClobberMemory();
+    }
+    layer_evaluations(state, wavelengthCount);
+}
+
+void BM_angular_reflectance_transmittance(benchmark::State &state) {
+    vector<thinfilm::Layer> layers = make_layers(state.range(0), state.range(1));
+    const size_t angleCount = 1024;
+    vector<thinfilm::complex> cosTheta(angleCount);
+    for (size_t k = 0; k < angleCount; ++k) {
+        cosTheta[k] = cos(1.5 * k / angleCount);
+    }
+    vector<double> reflectanceP(angleCount), reflectanceS(angleCount);
+    vector<double> transmittanceP(angleCount), transmittanceS(angleCount);
+    for (auto _ : state) {
+        thinfilm::angular_reflectance_transmittance(cosTheta.data(), angleCount, 1.0, 1.52, layers,
+                                                    reflectanceP.data(), reflectanceS.data(),
+                                                    transmittanceP.data(), transmittanceS.data());
+        benchmark::ClobberMemory();
+    }
+    layer_evaluations(state, angleCount);
+}
+
+// FixedStack<N> with the medium terms shared by the iterations, the argument
+// is absorbing
+template <size_t N>
+void BM_fixed_reflectance_transmittance(benchmark::State &state) {
+    vector<thinfilm::Layer> layers = make_layers(N, state.range(0));
+    thinfilm::FixedStack<N> fixed;
+    copy(layers.begin(), layers.end(), fixed.begin());
+    thinfilm::MediumTerms media(0.8, 1.0, 1.52);
+    double reflectanceP, reflectanceS, transmittanceP, transmittanceS;
+    for (auto _ : state) {
+        thinfilm::reflectance_transmittance(media, fixed,
+                                            &reflectanceP, &reflectanceS,
+                                            &transmittanceP, &transmittanceS);
+        benchmark::DoNotOptimize(reflectanceP);
+        benchmark::DoNotOptimize(transmittanceS);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()) * N);
+}
+
+// (number of layers, absorbing)
+void stacks(benchmark::internal::Benchmark *b) {
+    b->ArgNames({ "layers", "absorbing" });
+    for (int absorbing = 0; absorbing <= 1; ++absorbing) {
+        for (int n : { 2, 10, 100, 1000 }) {
+            b->Args({ n, absorbing });
+        }
+    }
+}
+
+}
+
+BENCHMARK(BM_transfer_matrix_PS)->Apply(stacks);
+BENCHMARK(BM_reflectance_transmittance)->Apply(stacks);
+BENCHMARK(BM_reflectance)->Apply(stacks);
+BENCHMARK(BM_reflectance_S)->Apply(stacks);
+BENCHMARK(BM_spectral_reflectance_transmittance)->Apply(stacks);
+BENCHMARK(BM_spectral_reflectance_transmittance_simd)->Apply(stacks);
+BENCHMARK(BM_spectral_reflectance_transmittance_simd_float)->Apply(stacks);
+BENCHMARK(BM_angular_reflectance_transmittance)->Apply(stacks);
+BENCHMARK_TEMPLATE(BM_fixed_reflectance_transmittance, 2)->ArgName("absorbing")->DenseRange(0, 1);
+BENCHMARK_TEMPLATE(BM_fixed_reflectance_transmittance, 4)->ArgName("absorbing")->DenseRange(0, 1);
+BENCHMARK_TEMPLATE(BM_fixed_reflectance_transmittance, 8)->ArgName("absorbing")->DenseRange(0, 1);
+
+// the instruction set of the SIMD sweeps is reported in the context
+int main(int argc, char **argv) {
+    benchmark::AddCustomContext("simd_path", thinfilm::simd_path_name(thinfilm::simd_kernels().path));
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,330 @@
+#ifndef THINFILM_CACHE_H
+#define THINFILM_CACHE_H
+
+#include "thinfilm.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+// Memoized evaluation of stacks on grids of wavelengths and angles
+//
+// Repeated queries of the same stack on the same grid are answered from a
+// bounded least recently used cache. A miss starts from the deepest cached
+// prefix product A_0 C_1 ... C_K of the stack on the grid, the prefixes are
+// kept at the depths K = 1, 2, 4, 8, ... of every evaluated stack, so stacks
+// sharing a base coating only multiply the layers above it (at most half of
+// the base is recomputed).
+// The caches are split in shards with one lock each, concurrent queries on
+// different keys rarely wait for each other.
+
+namespace thinfilm {
+
+// Exact key of a cache entry with its hash, the values are compared on a hash
+// match so that a collision never returns another result
+struct CacheKey {
+    CacheKey()
+        : hash(0) {
+    }
+
+    void add(double x) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &x, sizeof(bits));
+        hash = (hash ^ bits) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+        values.push_back(x);
+    }
+
+    void add(complex z) {
+        add(z.real());
+        add(z.imag());
+    }
+
+    bool operator==(const CacheKey &other) const {
+        return hash == other.hash && values == other.values;
+    }
+
+    std::uint64_t hash;
+    std::vector<double> values;
+};
+
+struct CacheKeyHash {
+    std::size_t operator()(const CacheKey &key) const {
+        return std::size_t(key.hash);
+    }
+};
+
+// Bounded map from keys to shared values, least recently used entries are
+// evicted first. Thread safe.
+template <class Value>
+class LruCache {
+public:
+    // capacity entries split in shardCount shards, or in capacity shards of
+    // one entry if it is smaller. A capacity of 0 caches nothing.
+    explicit LruCache(std::size_t capacity, std::size_t shardCount = 16)
+        : shards_(std::max<std::size_t>(std::min(shardCount, capacity), 1)), evictions_(0) {
+        for (std::size_t s = 0; s < shards_.size(); ++s) {
+            shards_[s].reset(new Shard);
+            shards_[s]->capacity = capacity / shards_.size() + (s < capacity % shards_.size() ? 1 : 0);
+        }
+    }
+
+    // Null if the key is not cached
+    std::shared_ptr<const Value> find(const CacheKey &key) {
+        Shard &shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        typename Map::iterator entry = shard.map.find(key);
+        if (entry == shard.map.end()) {
+            return std::shared_ptr<const Value>();
+        }
+        shard.order.splice(shard.order.begin(), shard.order, entry->second.position);
+        return entry->second.value;
+    }
+
+    void insert(const CacheKey &key, const std::shared_ptr<const Value> &value) {
+        Shard &shard = shard_of(key);
+        if (shard.capacity == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::pair<typename Map::iterator, bool> entry = shard.map.insert(std::make_pair(key, Entry()));
+        if (!entry.second) {
+            // a concurrent miss inserted the same value
+            return;
+        }
+        shard.order.push_front(&entry.first->first);
+        entry.first->second.value = value;
+        entry.first->second.position = shard.order.begin();
+
+        if (shard.map.size() > shard.capacity) {
+            // erase through an iterator, the key of the list points into the
+            // node being erased
+            typename Map::iterator victim = shard.map.find(*shard.order.back());
+            shard.map.erase(victim);
+            shard.order.pop_back();
+            ++evictions_;
+        }
+    }
+
+    void clear() {
+        for (std::size_t s = 0; s < shards_.size(); ++s) {
+            std::lock_guard<std::mutex> lock(shards_[s]->mutex);
+            shards_[s]->map.clear();
+            shards_[s]->order.clear();
+        }
+    }
+
+    std::size_t size() const {
+        std::size_t size = 0;
+        for (std::size_t s = 0; s < shards_.size(); ++s) {
+            std::lock_guard<std::mutex> lock(shards_[s]->mutex);
+            size += shards_[s]->map.size();
+        }
+        return size;
+    }
+
+    std::uint64_t evictions() const {
+        return evictions_;
+    }
+
+private:
+    LruCache(const LruCache &);
+    LruCache &operator=(const LruCache &);
+
+    // the keys of the list point to the keys of the map, which do not move.
+    // Iterators of the map would not do, a rehash invalidates them.
+    typedef std::list<const CacheKey *> Order;
+    struct Entry {
+        std::shared_ptr<const Value> value;
+        typename Order::iterator position;
+    };
+    typedef std::unordered_map<CacheKey, Entry, CacheKeyHash> Map;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        Map map;
+        // most recently used first
+        Order order;
+        std::size_t capacity;
+    };
+
+    Shard &shard_of(const CacheKey &key) {
+        // the high bits, the low ones select the buckets of the map
+        return *shards_[(key.hash >> 48) % shards_.size()];
+    }
+
+    std::vector<std::unique_ptr<Shard> > shards_;
+    std::atomic<std::uint64_t> evictions_;
+};
+
+struct CacheStatistics {
+    std::uint64_t hits;
+    std::uint64_t misses;
+    // misses that started from a cached prefix, and the layers it saved
+    std::uint64_t prefixHits;
+    std::uint64_t prefixLayers;
+    std::uint64_t evictions;
+};
+
+// Reflectance and transmittance of stacks on grids, with the result and the
+// prefix caches
+//
+// Same as one stack of batch_reflectance_transmittance: the thicknesses are in
+// the unit of the wavelengths and the outputs hold wavelengthCount * angleCount
+// values, the result of (wavelengths[k], incidentCosTheta[a]) at
+// k * angleCount + a.
+class EvaluationCache {
+public:
+    // capacity results and prefixCapacity prefixes, every one of them holds
+    // the values of a whole grid. A capacity of 0 disables that cache.
+    explicit EvaluationCache(std::size_t capacity, std::size_t prefixCapacity = 0,
+                             std::size_t shardCount = 16)
+        : results_(capacity, shardCount), prefixes_(prefixCapacity, shardCount),
+          prefixes_enabled_(prefixCapacity > 0), hits_(0), misses_(0), prefixHits_(0), prefixLayers_(0) {
+    }
+
+    // nIncident * incidentSinTheta MUST be real
+    template <class Stack>
+    void reflectance_transmittance(complex nIncident, complex nExit, const Stack &layers,
+                                   const double *wavelengths, std::size_t wavelengthCount,
+                                   const complex *incidentCosTheta, std::size_t angleCount,
+                                   double *reflectanceP, double *reflectanceS,
+                                   double *transmittanceP, double *transmittanceS) {
+        std::size_t gridSize = wavelengthCount * angleCount;
+
+        // the prefixes do not depend on the exit medium, it is only in the
+        // key of the result
+        CacheKey grid;
+        grid.add(nIncident);
+        grid.add(double(wavelengthCount));
+        for (std::size_t k = 0; k < wavelengthCount; ++k) {
+            grid.add(wavelengths[k]);
+        }
+        grid.add(double(angleCount));
+        for (std::size_t a = 0; a < angleCount; ++a) {
+            grid.add(incidentCosTheta[a]);
+        }
+
+        // keys of the prefixes at the depths 1, 2, 4, ... and of the stack
+        std::vector<CacheKey> prefixKeys;
+        std::vector<std::size_t> depths;
+        CacheKey key = grid;
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            key.add(layers[i].thickness);
+            key.add(layers[i].refractiveIndex);
+            if (prefixes_enabled_ && ((i + 1) & i) == 0) {
+                prefixKeys.push_back(key);
+                depths.push_back(i + 1);
+            }
+        }
+        key.add(double(layers.size()));
+        key.add(nExit);
+
+        std::shared_ptr<const std::vector<double> > result = results_.find(key);
+        if (result) {
+            ++hits_;
+            THINFILM_COUNT(ResultCacheHits, 1);
+            const double *values = result->data();
+            std::copy(values, values + gridSize, reflectanceP);
+            std::copy(values + gridSize, values + 2 * gridSize, reflectanceS);
+            std::copy(values + 2 * gridSize, values + 3 * gridSize, transmittanceP);
+            std::copy(values + 3 * gridSize, values + 4 * gridSize, transmittanceS);
+            return;
+        }
+        ++misses_;
+        THINFILM_COUNT(ResultCacheMisses, 1);
+
+        // deepest cached prefix, the deeper ones are computed on the way
+        std::shared_ptr<const std::vector<Matrix22> > prefix;
+        std::size_t first = 0;
+        std::size_t computed = 0;
+        for (std::size_t p = prefixKeys.size(); p-- > 0;) {
+            prefix = prefixes_.find(prefixKeys[p]);
+            if (prefix) {
+                first = depths[p];
+                computed = p + 1;
+                ++prefixHits_;
+                THINFILM_COUNT(PrefixCacheHits, 1);
+                prefixLayers_ += first;
+                break;
+            }
+        }
+        std::vector<std::shared_ptr<std::vector<Matrix22> > > checkpoints;
+        for (std::size_t p = computed; p < depths.size(); ++p) {
+            checkpoints.push_back(std::make_shared<std::vector<Matrix22> >(2 * gridSize));
+        }
+
+        std::shared_ptr<std::vector<double> > values = std::make_shared<std::vector<double> >(4 * gridSize);
+        for (std::size_t k = 0; k < wavelengthCount; ++k) {
+            double waveNumber = 2.0 * M_PI / wavelengths[k];
+
+            for (std::size_t a = 0; a < angleCount; ++a) {
+                std::size_t out = k * angleCount + a;
+                complex nSinThetaSquared = (1.0 - incidentCosTheta[a] * incidentCosTheta[a]) *
+                                           (nIncident * nIncident);
+
+                Matrix22 MatP, MatS;
+                if (prefix) {
+                    MatP = (*prefix)[2 * out];
+                    MatS = (*prefix)[2 * out + 1];
+                } else {
+                    incident_matrices_PS(incidentCosTheta[a], nIncident, &MatP, &MatS);
+                }
+
+                std::size_t checkpoint = 0;
+                for (std::size_t i = first; i < layers.size(); ++i) {
+                    multiply_layer_PS(layers[i].refractiveIndex, nSinThetaSquared,
+                                      waveNumber * layers[i].thickness, &MatP, &MatS);
+                    if (checkpoint < checkpoints.size() && i + 1 == depths[computed + checkpoint]) {
+                        (*checkpoints[checkpoint])[2 * out] = MatP;
+                        (*checkpoints[checkpoint])[2 * out + 1] = MatS;
+                        ++checkpoint;
+                    }
+                }
+
+                complex exitCosTheta = multiply_exit_PS(nSinThetaSquared, nExit, &MatP, &MatS);
+                power_coefficients_PS(MatP, MatS, incidentCosTheta[a], nIncident, exitCosTheta, nExit,
+                                      &(*values)[out], &(*values)[gridSize + out],
+                                      &(*values)[2 * gridSize + out], &(*values)[3 * gridSize + out]);
+            }
+        }
+
+        for (std::size_t c = 0; c < checkpoints.size(); ++c) {
+            prefixes_.insert(prefixKeys[computed + c], checkpoints[c]);
+        }
+        results_.insert(key, values);
+
+        std::copy(values->begin(), values->begin() + gridSize, reflectanceP);
+        std::copy(values->begin() + gridSize, values->begin() + 2 * gridSize, reflectanceS);
+        std::copy(values->begin() + 2 * gridSize, values->begin() + 3 * gridSize, transmittanceP);
+        std::copy(values->begin() + 3 * gridSize, values->end(), transmittanceS);
+    }
+
+    CacheStatistics statistics() const {
+        CacheStatistics statistics = { hits_, misses_, prefixHits_, prefixLayers_,
+                                       results_.evictions() + prefixes_.evictions() };
+        return statistics;
+    }
+
+    void clear() {
+        results_.clear();
+        prefixes_.clear();
+    }
+
+private:
+    LruCache<std::vector<double> > results_;
+    LruCache<std::vector<Matrix22> > prefixes_;
+    bool prefixes_enabled_;
+
+    std::atomic<std::uint64_t> hits_;
+    std::atomic<std::uint64_t> misses_;
+    std::atomic<std::uint64_t> prefixHits_;
+    std::atomic<std::uint64_t> prefixLayers_;
+};
+
+}
+#endif
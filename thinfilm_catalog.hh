@@ -0,0 +1,488 @@
+#ifndef THINFILM_CATALOG_H
+#define THINFILM_CATALOG_H
+
+#include "thinfilm_batch.hh"
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Columnar files of stack catalogs and of their spectra (POSIX, mmap)
+//
+// A catalog file stores the arrays of a StackArena one after the other, a
+// mapped catalog is used in place as a StackArenaView:
+//
+//     CatalogHeader     64 bytes
+//     uint64            offsets[stackCount + 1], the layers of the stack s are
+//                       offsets[s] ... offsets[s + 1] - 1
+//     double            thicknesses[layerCount]
+//     double            refractiveIndices[layerCount], (real, imaginary) pairs
+//
+// A spectrum file stores the grid and the four outputs of
+// batch_reflectance_transmittance, as columns:
+//
+//     SpectrumHeader    128 bytes
+//     double            wavelengths[wavelengthCount]
+//     double            incidentCosTheta[angleCount], (real, imaginary) pairs
+//     double            reflectanceP[stackCount * wavelengthCount * angleCount]
+//     double            reflectanceS[...], transmittanceP[...], transmittanceS[...]
+//
+// the result of (stack s, wavelengths[k], incidentCosTheta[a]) at
+// (s * wavelengthCount + k) * angleCount + a of every column. The values are
+// native endian and every section starts on 64 bytes. Stacks are evaluated in
+// chunks straight from the mapped catalog into the mapped spectra, nothing is
+// parsed or copied.
+
+namespace thinfilm {
+
+struct CatalogHeader {
+    char magic[8];
+    std::uint64_t version;
+    std::uint64_t stackCount;
+    std::uint64_t layerCount;
+    // byte offsets of the sections in the file
+    std::uint64_t offsetsOffset;
+    std::uint64_t thicknessesOffset;
+    std::uint64_t refractiveIndicesOffset;
+    std::uint64_t size;
+};
+
+struct SpectrumHeader {
+    char magic[8];
+    std::uint64_t version;
+    std::uint64_t stackCount;
+    std::uint64_t wavelengthCount;
+    std::uint64_t angleCount;
+    double nIncident[2];
+    double nExit[2];
+    std::uint64_t wavelengthsOffset;
+    std::uint64_t anglesOffset;
+    // the four columns, one after the other
+    std::uint64_t columnsOffset;
+    std::uint64_t size;
+    // random id drawn by SpectrumFile::create, tells two creations of the
+    // same file apart
+    std::uint64_t runId;
+    std::uint64_t reserved[2];
+};
+
+static_assert(sizeof(CatalogHeader) == 64, "CatalogHeader is 64 bytes");
+static_assert(sizeof(SpectrumHeader) == 128, "SpectrumHeader is 128 bytes");
+static_assert(sizeof(std::size_t) == sizeof(std::uint64_t), "the offsets are mapped as size_t");
+
+// Whole file mapped in memory
+class MappedFile {
+public:
+    MappedFile()
+        : data_(0), size_(0), writable_(false) {
+    }
+
+    ~MappedFile() {
+        close();
+    }
+
+    // Map an existing file, read only unless writable
+    bool open(const char *path, bool writable = false) {
+        close();
+        int fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0 && map(fd, st.st_size, writable);
+        ::close(fd);
+        return ok;
+    }
+
+    // Create or truncate a file of size bytes (zeros) and map it writable
+    bool create(const char *path, std::size_t size) {
+        close();
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = ftruncate(fd, off_t(size)) == 0 && map(fd, size, true);
+        ::close(fd);
+        return ok;
+    }
+
+    void close() {
+        if (data_ != 0) {
+            munmap(data_, size_);
+        }
+        data_ = 0;
+        size_ = 0;
+        writable_ = false;
+    }
+
+    // Write the changes of a writable mapping to the file
+    bool sync() {
+        return data_ == 0 || msync(data_, size_, MS_SYNC) == 0;
+    }
+
+    // Same for the pages holding [offset, offset + size)
+    bool sync(std::size_t offset, std::size_t size) {
+        if (data_ == 0 || size == 0) {
+            return true;
+        }
+        std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+        std::size_t begin = offset / page * page;
+        std::size_t end = std::min(offset + size, size_);
+        return msync(data() + begin, end - begin, MS_SYNC) == 0;
+    }
+
+    // Hint a sequential pass over the file
+    void advise_sequential() const {
+        if (data_ != 0) {
+            madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+    }
+
+    char *data() const {
+        return static_cast<char *>(data_);
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    bool writable() const {
+        return writable_;
+    }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    bool map(int fd, std::size_t size, bool writable) {
+        if (size == 0) {
+            return false;
+        }
+        void *data = mmap(0, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        data_ = data;
+        size_ = size;
+        writable_ = writable;
+        return true;
+    }
+
+    void *data_;
+    std::size_t size_;
+    bool writable_;
+};
+
+// Start of the section after size bytes at offset, on 64 bytes
+inline std::uint64_t catalog_section(std::uint64_t offset, std::uint64_t size) {
+    return (offset + size + 63) / 64 * 64;
+}
+
+// Mapped catalog file
+class StackCatalog {
+public:
+    StackCatalog() {
+    }
+
+    // Map a catalog read only, false if it is not a valid catalog
+    bool open(const char *path) {
+        return file_.open(path) && check();
+    }
+
+    // Create a catalog of stackCount stacks and layerCount layers in total,
+    // mapped writable, to fill through offsets(), thicknesses() and
+    // refractive_indices(). offsets()[0] is 0 and offsets()[stackCount] is
+    // layerCount, the others are 0 until written.
+    bool create(const char *path, std::size_t stackCount, std::size_t layerCount) {
+        CatalogHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "TFCATLG1", 8);
+        header.version = 1;
+        header.stackCount = stackCount;
+        header.layerCount = layerCount;
+        header.offsetsOffset = catalog_section(0, sizeof(header));
+        header.thicknessesOffset = catalog_section(header.offsetsOffset, 8 * (stackCount + 1));
+        header.refractiveIndicesOffset = catalog_section(header.thicknessesOffset, 8 * layerCount);
+        header.size = header.refractiveIndicesOffset + 16 * layerCount;
+
+        if (!file_.create(path, header.size)) {
+            return false;
+        }
+        std::memcpy(file_.data(), &header, sizeof(header));
+        offsets()[stackCount] = layerCount;
+        return check();
+    }
+
+    // Create a catalog holding a copy of stacks (a StackArena or a
+    // StackArenaView)
+    template <class Stacks>
+    bool create(const char *path, const Stacks &stacks) {
+        std::size_t layerCount = 0;
+        for (std::size_t s = 0; s < stacks.size(); ++s) {
+            layerCount += stacks[s].size();
+        }
+        if (!create(path, stacks.size(), layerCount)) {
+            return false;
+        }
+        std::size_t offset = 0;
+        for (std::size_t s = 0; s < stacks.size(); ++s) {
+            StackView layers = stacks[s];
+            offsets()[s] = offset;
+            std::copy(layers.thicknesses, layers.thicknesses + layers.size(), thicknesses() + offset);
+            std::copy(layers.refractiveIndices, layers.refractiveIndices + layers.size(),
+                      refractive_indices() + offset);
+            offset += layers.size();
+        }
+        return file_.sync();
+    }
+
+    std::size_t size() const {
+        return header().stackCount;
+    }
+
+    std::size_t layer_count() const {
+        return header().layerCount;
+    }
+
+    // The arrays are writable after create only
+    std::size_t *offsets() const {
+        return reinterpret_cast<std::size_t *>(file_.data() + header().offsetsOffset);
+    }
+
+    double *thicknesses() const {
+        return reinterpret_cast<double *>(file_.data() + header().thicknessesOffset);
+    }
+
+    complex *refractive_indices() const {
+        return reinterpret_cast<complex *>(file_.data() + header().refractiveIndicesOffset);
+    }
+
+    StackArenaView stacks() const {
+        return chunk(0, size());
+    }
+
+    // The stacks [first, first + count) as an arena of count stacks
+    StackArenaView chunk(std::size_t first, std::size_t count) const {
+        return StackArenaView(offsets() + first, count, thicknesses(), refractive_indices());
+    }
+
+    // Check that the offsets are increasing and inside the layers, O(size())
+    bool check_offsets() const {
+        const std::size_t *o = offsets();
+        for (std::size_t s = 0; s < size(); ++s) {
+            if (o[s + 1] < o[s]) {
+                return false;
+            }
+        }
+        return o[0] == 0 && o[size()] == layer_count();
+    }
+
+    MappedFile &file() {
+        return file_;
+    }
+
+private:
+    StackCatalog(const StackCatalog &);
+    StackCatalog &operator=(const StackCatalog &);
+
+    const CatalogHeader &header() const {
+        return *reinterpret_cast<const CatalogHeader *>(file_.data());
+    }
+
+    // the header and the sections fit in the file, the offsets are not read
+    bool check() {
+        if (file_.size() < sizeof(CatalogHeader)) {
+            file_.close();
+            return false;
+        }
+        const CatalogHeader &h = header();
+        bool ok = std::memcmp(h.magic, "TFCATLG1", 8) == 0 && h.version == 1 && h.size <= file_.size() &&
+                  h.offsetsOffset % 64 == 0 && h.thicknessesOffset % 64 == 0 &&
+                  h.refractiveIndicesOffset % 64 == 0 &&
+                  h.stackCount < (std::uint64_t(1) << 56) && h.layerCount < (std::uint64_t(1) << 56) &&
+                  h.offsetsOffset + 8 * (h.stackCount + 1) <= h.thicknessesOffset &&
+                  h.thicknessesOffset + 8 * h.layerCount <= h.refractiveIndicesOffset &&
+                  h.refractiveIndicesOffset + 16 * h.layerCount <= h.size;
+        if (!ok) {
+            file_.close();
+        }
+        return ok;
+    }
+
+    MappedFile file_;
+};
+
+// Mapped spectrum file
+class SpectrumFile {
+public:
+    SpectrumFile() {
+    }
+
+    // Map spectra, read only unless writable, false if it is not a valid
+    // spectrum file
+    bool open(const char *path, bool writable = false) {
+        return file_.open(path, writable) && check();
+    }
+
+    // Create the spectra of stackCount stacks on a grid, mapped writable, the
+    // columns are zero
+    bool create(const char *path, std::size_t stackCount, complex nIncident, complex nExit,
+                const double *wavelengths, std::size_t wavelengthCount,
+                const complex *incidentCosTheta, std::size_t angleCount) {
+        SpectrumHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "TFSPECT1", 8);
+        header.version = 1;
+        header.stackCount = stackCount;
+        header.wavelengthCount = wavelengthCount;
+        header.angleCount = angleCount;
+        header.nIncident[0] = nIncident.real();
+        header.nIncident[1] = nIncident.imag();
+        header.nExit[0] = nExit.real();
+        header.nExit[1] = nExit.imag();
+        header.wavelengthsOffset = catalog_section(0, sizeof(header));
+        header.anglesOffset = catalog_section(header.wavelengthsOffset, 8 * wavelengthCount);
+        header.columnsOffset = catalog_section(header.anglesOffset, 16 * angleCount);
+        header.size = header.columnsOffset + 4 * 8 * stackCount * wavelengthCount * angleCount;
+        std::random_device device;
+        header.runId = (std::uint64_t(device()) << 32 | device()) ^
+                       std::uint64_t(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+                       std::uint64_t(getpid()) << 48;
+
+        if (!file_.create(path, header.size)) {
+            return false;
+        }
+        std::memcpy(file_.data(), &header, sizeof(header));
+        std::copy(wavelengths, wavelengths + wavelengthCount, this->wavelengths());
+        std::copy(incidentCosTheta, incidentCosTheta + angleCount, incident_cos_theta());
+        return check();
+    }
+
+    std::size_t size() const {
+        return header().stackCount;
+    }
+
+    std::size_t wavelength_count() const {
+        return header().wavelengthCount;
+    }
+
+    std::size_t angle_count() const {
+        return header().angleCount;
+    }
+
+    // values of one stack in every column
+    std::size_t stack_stride() const {
+        return wavelength_count() * angle_count();
+    }
+
+    std::uint64_t run_id() const {
+        return header().runId;
+    }
+
+    complex n_incident() const {
+        return complex(header().nIncident[0], header().nIncident[1]);
+    }
+
+    complex n_exit() const {
+        return complex(header().nExit[0], header().nExit[1]);
+    }
+
+    double *wavelengths() const {
+        return reinterpret_cast<double *>(file_.data() + header().wavelengthsOffset);
+    }
+
+    complex *incident_cos_theta() const {
+        return reinterpret_cast<complex *>(file_.data() + header().anglesOffset);
+    }
+
+    // column 0 to 3: reflectanceP, reflectanceS, transmittanceP, transmittanceS
+    double *column(std::size_t c) const {
+        return reinterpret_cast<double *>(file_.data() + header().columnsOffset) + c * size() * stack_stride();
+    }
+
+    double *reflectance_p() const {
+        return column(0);
+    }
+
+    double *reflectance_s() const {
+        return column(1);
+    }
+
+    double *transmittance_p() const {
+        return column(2);
+    }
+
+    double *transmittance_s() const {
+        return column(3);
+    }
+
+    MappedFile &file() {
+        return file_;
+    }
+
+private:
+    SpectrumFile(const SpectrumFile &);
+    SpectrumFile &operator=(const SpectrumFile &);
+
+    const SpectrumHeader &header() const {
+        return *reinterpret_cast<const SpectrumHeader *>(file_.data());
+    }
+
+    bool check() {
+        if (file_.size() < sizeof(SpectrumHeader)) {
+            file_.close();
+            return false;
+        }
+        const SpectrumHeader &h = header();
+        // no product below overflows
+        const std::uint64_t limit = std::uint64_t(1) << 28;
+        bool ok = std::memcmp(h.magic, "TFSPECT1", 8) == 0 && h.version == 1 && h.size <= file_.size() &&
+                  h.wavelengthsOffset % 64 == 0 && h.anglesOffset % 64 == 0 && h.columnsOffset % 64 == 0 &&
+                  h.wavelengthCount < limit && h.angleCount < limit &&
+                  h.wavelengthCount * h.angleCount < limit && h.stackCount < limit * limit &&
+                  h.stackCount * std::max<std::uint64_t>(h.wavelengthCount * h.angleCount, 1) < (limit << 28) &&
+                  h.wavelengthsOffset + 8 * h.wavelengthCount <= h.anglesOffset &&
+                  h.anglesOffset + 16 * h.angleCount <= h.columnsOffset &&
+                  h.columnsOffset + 32 * h.stackCount * h.wavelengthCount * h.angleCount <= h.size;
+        if (!ok) {
+            file_.close();
+        }
+        return ok;
+    }
+
+    MappedFile file_;
+};
+
+// Evaluate the stacks of a catalog into a writable spectrum file of the same
+// number of stacks, chunkSize stacks at a time
+//
+// The pages of a chunk are touched by the pool only, the kernel reads the
+// catalog ahead and writes the spectra back on its own. Returns false if the
+// sizes differ, the spectra are read only or writing them back fails.
+inline bool evaluate_catalog(WorkStealingPool &pool, const StackCatalog &catalog, SpectrumFile *spectra,
+                             std::size_t chunkSize = 65536) {
+    if (catalog.size() != spectra->size() || !spectra->file().writable()) {
+        return false;
+    }
+    chunkSize = std::max<std::size_t>(chunkSize, 1);
+    std::size_t stride = spectra->stack_stride();
+    for (std::size_t first = 0; first < catalog.size(); first += chunkSize) {
+        std::size_t count = std::min(chunkSize, catalog.size() - first);
+        std::size_t out = first * stride;
+        batch_reflectance_transmittance(pool, spectra->n_incident(), spectra->n_exit(),
+                                        catalog.chunk(first, count),
+                                        spectra->wavelengths(), spectra->wavelength_count(),
+                                        spectra->incident_cos_theta(), spectra->angle_count(),
+                                        spectra->reflectance_p() + out, spectra->reflectance_s() + out,
+                                        spectra->transmittance_p() + out, spectra->transmittance_s() + out);
+    }
+    return spectra->file().sync();
+}
+
+}
+#endif
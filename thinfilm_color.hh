@@ -0,0 +1,342 @@
+#ifndef THINFILM_COLOR_H
+#define THINFILM_COLOR_H
+
+#include "thinfilm_material.hh"
+
+// Integrated quantities: weighted sums of the power coefficients over the
+// wavelengths, e.g. CIE XYZ colors, photopic reflectance or band averages
+//
+// The weighted sums are accumulated inside the wavelength loop, no spectrum is
+// stored. The adaptive integration places the wavelengths where the
+// integrand varies, fringes of thick stacks get more samples than flat parts.
+
+namespace thinfilm {
+
+// Power coefficients of a stack of materials at one wavelength, same as one
+// wavelength of the MaterialStack spectral_reflectance_transmittance
+inline void reflectance_transmittance(complex incidentCosTheta,
+                                      const Material &incident, const Material &exit,
+                                      const MaterialStack &layers, double wavelength,
+                                      double *reflectanceP, double *reflectanceS,
+                                      double *transmittanceP, double *transmittanceS) {
+    complex nI = incident.refractive_index(wavelength);
+    complex nE = exit.refractive_index(wavelength);
+
+    Matrix22 MatP, MatS;
+    incident_matrices_PS(incidentCosTheta, nI, &MatP, &MatS);
+
+    complex nSinThetaSquared = (1.0 - incidentCosTheta * incidentCosTheta) * (nI * nI);
+    double waveNumber = 2.0 * M_PI / wavelength;
+
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        multiply_layer_PS(layers.material(i).refractive_index(wavelength), nSinThetaSquared,
+                          waveNumber * layers.thickness(i), &MatP, &MatS);
+    }
+
+    complex exitCosTheta = multiply_exit_PS(nSinThetaSquared, nE, &MatP, &MatS);
+
+    power_coefficients_PS(MatP, MatS, incidentCosTheta, nI, exitCosTheta, nE,
+                          reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+}
+
+// Weighted sums over a grid of wavelengths
+//
+// weights[k * channelCount + c] is the weight of wavelengths[k] in the channel
+// c, quadrature weights included. Every output receives channelCount sums,
+// e.g. reflectanceP[c] = sum_k weights[k * channelCount + c] Rp(wavelengths[k]).
+// nIncident * incidentSinTheta MUST be real
+inline void integrated_reflectance_transmittance(complex incidentCosTheta,
+                                                 const Material &incident, const Material &exit,
+                                                 const MaterialStack &layers,
+                                                 const WavelengthGrid &wavelengths,
+                                                 const double *weights, std::size_t channelCount,
+                                                 double *reflectanceP, double *reflectanceS,
+                                                 double *transmittanceP, double *transmittanceS) {
+    typedef std::shared_ptr<const std::vector<complex> > Table;
+
+    std::vector<Table> tables(layers.size());
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        tables[i] = layers.material(i).refractive_indices(wavelengths);
+    }
+    Table nIncident = incident.refractive_indices(wavelengths);
+    Table nExit = exit.refractive_indices(wavelengths);
+
+    for (std::size_t c = 0; c < channelCount; ++c) {
+        reflectanceP[c] = reflectanceS[c] = transmittanceP[c] = transmittanceS[c] = 0.0;
+    }
+
+    complex incidentSinThetaSquared = 1.0 - incidentCosTheta * incidentCosTheta;
+
+    for (std::size_t k = 0; k < wavelengths.size(); ++k) {
+        complex nI = (*nIncident)[k];
+        complex nE = (*nExit)[k];
+
+        Matrix22 MatP, MatS;
+        incident_matrices_PS(incidentCosTheta, nI, &MatP, &MatS);
+
+        complex nSinThetaSquared = incidentSinThetaSquared * (nI * nI);
+        double waveNumber = 2.0 * M_PI / wavelengths[k];
+
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            multiply_layer_PS((*tables[i])[k], nSinThetaSquared, waveNumber * layers.thickness(i),
+                              &MatP, &MatS);
+        }
+
+        complex exitCosTheta = multiply_exit_PS(nSinThetaSquared, nE, &MatP, &MatS);
+
+        double Rp, Rs, Tp, Ts;
+        power_coefficients_PS(MatP, MatS, incidentCosTheta, nI, exitCosTheta, nE,
+                              &Rp, &Rs, &Tp, &Ts);
+
+        const double *w = weights + k * channelCount;
+        for (std::size_t c = 0; c < channelCount; ++c) {
+            reflectanceP[c] += w[c] * Rp;
+            reflectanceS[c] += w[c] * Rs;
+            transmittanceP[c] += w[c] * Tp;
+            transmittanceS[c] += w[c] * Ts;
+        }
+    }
+}
+
+// Integrals over [wavelengthMin, wavelengthMax] of the weighted power
+// coefficients, by adaptive Simpson quadrature
+//
+// weights(wavelength, w) writes the channelCount weights w[c] of a wavelength,
+// reflectanceP[c] receives the integral of w[c] Rp and so on. The interval is
+// first split in initialIntervals panels, then every panel is bisected until
+// the Simpson estimates of the two halves agree with the whole within the
+// tolerance (absolute, on every integral). Returns the number of evaluations
+// of the stack, at most maximumEvaluations (the integrals are then less
+// accurate than the tolerance).
+// nIncident * incidentSinTheta MUST be real
+template <class Weights>
+std::size_t adaptive_integrated_reflectance_transmittance(
+    complex incidentCosTheta, const Material &incident, const Material &exit,
+    const MaterialStack &layers, double wavelengthMin, double wavelengthMax,
+    const Weights &weights, std::size_t channelCount, double tolerance,
+    double *reflectanceP, double *reflectanceS,
+    double *transmittanceP, double *transmittanceS,
+    std::size_t initialIntervals = 16, std::size_t maximumEvaluations = 100000) {
+    // integrand: the 4 * channelCount weighted coefficients at a wavelength
+    const std::size_t size = 4 * channelCount;
+    std::vector<double> w(channelCount);
+    std::size_t evaluations = 0;
+    auto evaluate = [&](double wavelength, double *f) {
+        double R[4];
+        reflectance_transmittance(incidentCosTheta, incident, exit, layers, wavelength,
+                                  R, R + 1, R + 2, R + 3);
+        weights(wavelength, w.data());
+        for (std::size_t j = 0; j < 4; ++j) {
+            for (std::size_t c = 0; c < channelCount; ++c) {
+                f[j * channelCount + c] = w[c] * R[j];
+            }
+        }
+        ++evaluations;
+    };
+
+    // interval [a, b] with the integrand at a, (a + b) / 2 and b
+    struct Interval {
+        double a, b;
+        double tolerance;
+        std::size_t values;
+    };
+    std::vector<double> values;
+    std::vector<Interval> pending;
+
+    std::vector<double> sum(size, 0.0);
+    std::vector<double> fa(size), fm(size), fb(size);
+    std::vector<double> fl(size), fr(size);
+
+    double step = (wavelengthMax - wavelengthMin) / initialIntervals;
+    evaluate(wavelengthMin, fb.data());
+    for (std::size_t p = 0; p < initialIntervals; ++p) {
+        double a = wavelengthMin + p * step;
+        double b = p + 1 == initialIntervals ? wavelengthMax : a + step;
+        fa = fb;
+        evaluate(0.5 * (a + b), fm.data());
+        evaluate(b, fb.data());
+
+        Interval interval = { a, b, tolerance / initialIntervals, values.size() };
+        values.insert(values.end(), fa.begin(), fa.end());
+        values.insert(values.end(), fm.begin(), fm.end());
+        values.insert(values.end(), fb.begin(), fb.end());
+        pending.push_back(interval);
+
+        while (!pending.empty()) {
+            Interval x = pending.back();
+            pending.pop_back();
+            // the values of x are the last of the buffer
+            const double *xa = &values[x.values];
+            const double *xm = xa + size;
+            const double *xb = xm + size;
+
+            double m = 0.5 * (x.a + x.b);
+            evaluate(0.5 * (x.a + m), fl.data());
+            evaluate(0.5 * (m + x.b), fr.data());
+
+            double h = (x.b - x.a) / 12.0;
+            bool converged = true;
+            for (std::size_t j = 0; j < size; ++j) {
+                double whole = 2.0 * h * (xa[j] + 4.0 * xm[j] + xb[j]);
+                double halves = h * (xa[j] + 4.0 * fl[j] + 2.0 * xm[j] + 4.0 * fr[j] + xb[j]);
+                if (std::fabs(halves - whole) > 15.0 * x.tolerance) {
+                    converged = false;
+                    break;
+                }
+            }
+
+            if (converged || evaluations + 2 > maximumEvaluations) {
+                for (std::size_t j = 0; j < size; ++j) {
+                    double whole = 2.0 * h * (xa[j] + 4.0 * xm[j] + xb[j]);
+                    double halves = h * (xa[j] + 4.0 * fl[j] + 2.0 * xm[j] + 4.0 * fr[j] + xb[j]);
+                    // Richardson extrapolation of the two Simpson estimates
+                    sum[j] += halves + (halves - whole) / 15.0;
+                }
+                values.resize(x.values);
+                continue;
+            }
+
+            // the right half is pushed first, the left half is refined first
+            std::vector<double> left(xa, xm + size);
+            std::vector<double> right(xm, xb + size);
+            values.resize(x.values);
+
+            Interval r = { m, x.b, 0.5 * x.tolerance, values.size() };
+            values.insert(values.end(), right.begin(), right.begin() + size);
+            values.insert(values.end(), fr.begin(), fr.end());
+            values.insert(values.end(), right.begin() + size, right.end());
+
+            Interval l = { x.a, m, 0.5 * x.tolerance, values.size() };
+            values.insert(values.end(), left.begin(), left.begin() + size);
+            values.insert(values.end(), fl.begin(), fl.end());
+            values.insert(values.end(), left.begin() + size, left.end());
+
+            pending.push_back(r);
+            pending.push_back(l);
+        }
+    }
+
+    for (std::size_t c = 0; c < channelCount; ++c) {
+        reflectanceP[c] = sum[c];
+        reflectanceS[c] = sum[channelCount + c];
+        transmittanceP[c] = sum[2 * channelCount + c];
+        transmittanceS[c] = sum[3 * channelCount + c];
+    }
+    return evaluations;
+}
+
+// CIE 1931 2 degree color matching functions, wavelength in nm
+//
+// Multi-lobe Gaussian fit of Wyman, Sloan and Shirley, "Simple Analytic
+// Approximations to the CIE XYZ Color Matching Functions", JCGT 2(2) 2013
+inline void cie1931_color_matching(double wavelength, double *x, double *y, double *z) {
+    // piecewise Gaussian, sigma1 on the left of the mean and sigma2 on the right
+    struct Lobe {
+        static double g(double wavelength, double mean, double sigma1, double sigma2) {
+            double t = (wavelength - mean) / (wavelength < mean ? sigma1 : sigma2);
+            return std::exp(-0.5 * t * t);
+        }
+    };
+
+    *x = 1.056 * Lobe::g(wavelength, 599.8, 37.9, 31.0) +
+         0.362 * Lobe::g(wavelength, 442.0, 16.0, 26.7) -
+         0.065 * Lobe::g(wavelength, 501.1, 20.4, 26.2);
+    *y = 0.821 * Lobe::g(wavelength, 568.8, 46.9, 40.5) +
+         0.286 * Lobe::g(wavelength, 530.9, 16.3, 31.1);
+    *z = 1.217 * Lobe::g(wavelength, 437.0, 11.8, 36.0) +
+         0.681 * Lobe::g(wavelength, 459.0, 26.0, 13.8);
+}
+
+// Weights of the X, Y and Z channels under an illuminant
+//
+// illuminant(wavelength) is the relative spectral power, null for the equal
+// energy illuminant E. The weights are normalized so that a perfect reflector
+// has Y = 100 on [wavelengthMin, wavelengthMax] nm, the range that the colors
+// are integrated on.
+class CieXyzWeights {
+public:
+    explicit CieXyzWeights(double (*illuminant)(double) = 0, double wavelengthMin = 380.0,
+                           double wavelengthMax = 780.0)
+        : illuminant_(illuminant), wavelengthMin_(wavelengthMin), wavelengthMax_(wavelengthMax),
+          scale_(1.0) {
+        // integral of S y by the composite Simpson rule, y is smooth
+        const std::size_t n = 400;
+        double h = (wavelengthMax - wavelengthMin) / n;
+        double sum = 0.0;
+        for (std::size_t k = 0; k <= n; ++k) {
+            double w[3];
+            (*this)(wavelengthMin + k * h, w);
+            sum += (k == 0 || k == n ? 1.0 : (k % 2 == 1 ? 4.0 : 2.0)) * w[1];
+        }
+        scale_ = 100.0 / (sum * h / 3.0);
+    }
+
+    void operator()(double wavelength, double *w) const {
+        cie1931_color_matching(wavelength, w, w + 1, w + 2);
+        double s = scale_ * (illuminant_ ? illuminant_(wavelength) : 1.0);
+        w[0] *= s;
+        w[1] *= s;
+        w[2] *= s;
+    }
+
+    double wavelength_min() const {
+        return wavelengthMin_;
+    }
+
+    double wavelength_max() const {
+        return wavelengthMax_;
+    }
+
+private:
+    double (*illuminant_)(double);
+    double wavelengthMin_;
+    double wavelengthMax_;
+    double scale_;
+};
+
+struct Tristimulus {
+    double X, Y, Z;
+};
+
+struct Lab {
+    double L, a, b;
+};
+
+// CIE 1976 L*a*b* of a color seen under the white point white
+inline Lab cie_lab(const Tristimulus &color, const Tristimulus &white) {
+    struct F {
+        static double f(double t) {
+            const double delta = 6.0 / 29.0;
+            return t > delta * delta * delta ? std::cbrt(t) : t / (3.0 * delta * delta) + 4.0 / 29.0;
+        }
+    };
+    double fx = F::f(color.X / white.X);
+    double fy = F::f(color.Y / white.Y);
+    double fz = F::f(color.Z / white.Z);
+    Lab lab = { 116.0 * fy - 16.0, 500.0 * (fx - fy), 200.0 * (fy - fz) };
+    return lab;
+}
+
+// Colors of the unpolarized reflected and transmitted light over the range of
+// the weights, the thicknesses of the layers in nm
+// tolerance is on X, Y and Z (a perfect reflector has Y = 100)
+inline void reflected_transmitted_color(complex incidentCosTheta,
+                                        const Material &incident, const Material &exit,
+                                        const MaterialStack &layers, const CieXyzWeights &weights,
+                                        Tristimulus *reflected, Tristimulus *transmitted,
+                                        double tolerance = 1e-3) {
+    double Rp[3], Rs[3], Tp[3], Ts[3];
+    adaptive_integrated_reflectance_transmittance(incidentCosTheta, incident, exit, layers,
+                                                  weights.wavelength_min(), weights.wavelength_max(),
+                                                  weights, 3, tolerance,
+                                                  Rp, Rs, Tp, Ts);
+    reflected->X = 0.5 * (Rp[0] + Rs[0]);
+    reflected->Y = 0.5 * (Rp[1] + Rs[1]);
+    reflected->Z = 0.5 * (Rp[2] + Rs[2]);
+    transmitted->X = 0.5 * (Tp[0] + Ts[0]);
+    transmitted->Y = 0.5 * (Tp[1] + Ts[1]);
+    transmitted->Z = 0.5 * (Tp[2] + Ts[2]);
+}
+
+}
+#endif
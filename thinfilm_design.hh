@@ -0,0 +1,572 @@
+#ifndef THINFILM_DESIGN_H
+#define THINFILM_DESIGN_H
+
+#include "thinfilm.hh"
+#include "thinfilm_batch.hh"
+#include "thinfilm_evaluator.hh"
+#include "thinfilm_gradient.hh"
+#include "thinfilm_material.hh"
+#include <algorithm>
+#include <limits>
+
+// Design of a stack to target spectra with the needle technique
+//
+// The merit function is the weighted root mean square of the differences
+// between the power coefficients of the design and the targets. The
+// thicknesses are refined with damped least squares (Levenberg-Marquardt) on
+// the analytic derivatives of reflectance_transmittance_gradient. A needle
+// step evaluates the insertion of a thin layer of every material at many
+// depths of the design and inserts the one that decreases the merit the most,
+// the refinement then grows it. The targets of the refinement and the needle
+// candidates are evaluated on the threads of a WorkStealingPool, every thread
+// keeps the design in a StackEvaluator per target so that a candidate costs
+// O(log N) matrix products per target instead of O(N).
+
+namespace thinfilm {
+
+enum class TargetQuantity {
+    ReflectanceP,
+    ReflectanceS,
+    // mean of the two polarizations
+    Reflectance,
+    TransmittanceP,
+    TransmittanceS,
+    Transmittance
+};
+
+struct DesignTarget {
+    DesignTarget()
+        : wavelength(0.0), incidentCosTheta(1.0), quantity(TargetQuantity::Reflectance),
+          value(0.0), weight(1.0) {
+    }
+    DesignTarget(double wavelength, TargetQuantity quantity, double value, double weight = 1.0,
+                 complex incidentCosTheta = 1.0)
+        : wavelength(wavelength), incidentCosTheta(incidentCosTheta), quantity(quantity),
+          value(value), weight(weight) {
+    }
+
+    double wavelength;
+    // nIncident(wavelength) * incidentSinTheta MUST be real
+    complex incidentCosTheta;
+    TargetQuantity quantity;
+    double value;
+    double weight;
+};
+
+// Layer of a design, the thickness in the unit of the wavelengths and the
+// index of the material in the list of the optimizer
+struct DesignLayer {
+    DesignLayer()
+        : thickness(0.0), material(0) {
+    }
+    DesignLayer(double thickness, std::size_t material)
+        : thickness(thickness), material(material) {
+    }
+
+    double thickness;
+    std::size_t material;
+};
+
+struct DesignOptions {
+    DesignOptions()
+        : refineIterations(100), needlePositions(20), needleThickness(1e-3),
+          minimumThickness(1e-4), maximumLayers(100), maximumNeedles(50) {
+    }
+
+    // Levenberg-Marquardt iterations of one refinement
+    std::size_t refineIterations;
+    // depths tried in every layer by a needle step
+    std::size_t needlePositions;
+    // thickness of the needles and under which the layers are removed, in
+    // unit of the shortest target wavelength
+    double needleThickness;
+    double minimumThickness;
+    std::size_t maximumLayers;
+    std::size_t maximumNeedles;
+};
+
+class DesignOptimizer {
+public:
+    // The indices of the materials are tabulated at the target wavelengths
+    DesignOptimizer(WorkStealingPool &pool, const Material &incident, const Material &exit,
+                    const std::vector<std::shared_ptr<const Material> > &materials,
+                    const std::vector<DesignTarget> &targets)
+        : pool_(pool), targets_(targets), materialCount_(materials.size()),
+          shortestWavelength_(std::numeric_limits<double>::max()), weightSum_(0.0), squares_(0.0),
+          needleStep_(0), workers_(pool.size()) {
+        std::vector<double> wavelengths(targets.size());
+        for (std::size_t j = 0; j < targets.size(); ++j) {
+            wavelengths[j] = targets[j].wavelength;
+            shortestWavelength_ = std::min(shortestWavelength_, targets[j].wavelength);
+        }
+        WavelengthGrid grid(wavelengths);
+
+        nIncident_ = *incident.refractive_indices(grid);
+        nExit_ = *exit.refractive_indices(grid);
+        // refractiveIndices_[m * targetCount + j]
+        for (std::size_t m = 0; m < materials.size(); ++m) {
+            std::shared_ptr<const std::vector<complex> > table = materials[m]->refractive_indices(grid);
+            refractiveIndices_.insert(refractiveIndices_.end(), table->begin(), table->end());
+        }
+
+        for (std::size_t j = 0; j < targets.size(); ++j) {
+            weightSum_ += targets[j].weight;
+        }
+    }
+
+    // Root mean square of the weighted differences to the targets
+    double merit(const std::vector<DesignLayer> &design) {
+        merit_squares(design);
+        return root_mean(squares_);
+    }
+
+    // Refine the thicknesses, the materials and the number of layers do not
+    // change, returns the merit
+    double refine(std::vector<DesignLayer> *design, std::size_t iterations = 100) {
+        std::size_t N = design->size();
+        std::size_t J = targets_.size();
+        double current = merit_squares(*design);
+        if (N == 0) {
+            return root_mean(current);
+        }
+
+        std::vector<double> normal(N * N), gradient(N), step(N);
+        std::vector<DesignLayer> trial;
+        double damping = 1e-3;
+        for (std::size_t iteration = 0; iteration < iterations; ++iteration) {
+            jacobian(*design);
+
+            // J^T J and J^T r, r the weighted residuals
+            std::fill(normal.begin(), normal.end(), 0.0);
+            std::fill(gradient.begin(), gradient.end(), 0.0);
+            for (std::size_t j = 0; j < J; ++j) {
+                const double *row = &jacobian_[j * N];
+                for (std::size_t a = 0; a < N; ++a) {
+                    gradient[a] += row[a] * residuals_[j];
+                    for (std::size_t b = 0; b <= a; ++b) {
+                        normal[a * N + b] += row[a] * row[b];
+                    }
+                }
+            }
+
+            bool improved = false;
+            while (damping < 1e12) {
+                std::vector<double> A = normal;
+                for (std::size_t a = 0; a < N; ++a) {
+                    A[a * N + a] += damping * (A[a * N + a] + 1e-12);
+                    step[a] = -gradient[a];
+                }
+                if (!solve_cholesky(&A, &step, N)) {
+                    damping *= 4.0;
+                    continue;
+                }
+
+                trial = *design;
+                for (std::size_t a = 0; a < N; ++a) {
+                    trial[a].thickness = std::max(trial[a].thickness + step[a], 0.0);
+                }
+                double next = merit_squares(trial);
+                if (next < current) {
+                    improved = next < current * (1.0 - 1e-12);
+                    design->swap(trial);
+                    current = next;
+                    damping = std::max(damping / 3.0, 1e-12);
+                    break;
+                }
+                damping *= 4.0;
+            }
+            if (!improved) {
+                break;
+            }
+        }
+        return root_mean(current);
+    }
+
+    // Insert the needle that decreases the merit the most, false if no needle
+    // decreases it
+    bool insert_needle(std::vector<DesignLayer> *design, const DesignOptions &options = DesignOptions()) {
+        if (materialCount_ == 0) {
+            return false;
+        }
+        std::size_t N = design->size();
+        double current = merit_squares(*design);
+        double needle = options.needleThickness * shortestWavelength_;
+
+        // needles in every layer, on the incident side and on the exit side of
+        // the stack. groups_ starts the runs of candidates in the same layer.
+        candidates_.clear();
+        groups_.clear();
+        for (std::size_t m = 0; m < materialCount_; ++m) {
+            groups_.push_back(candidates_.size());
+            candidates_.push_back(Candidate(0, 0.0, m));
+            groups_.push_back(candidates_.size());
+            candidates_.push_back(Candidate(N, 0.0, m));
+            for (std::size_t i = 0; i < N; ++i) {
+                if ((*design)[i].material == m || options.needlePositions == 0) {
+                    continue;
+                }
+                groups_.push_back(candidates_.size());
+                for (std::size_t p = 0; p < options.needlePositions; ++p) {
+                    candidates_.push_back(Candidate(i, (p + 0.5) / options.needlePositions, m));
+                }
+            }
+        }
+        groups_.push_back(candidates_.size());
+
+        // the evaluators of the workers are built from the design on their
+        // first group of the step
+        ++needleStep_;
+        struct Task {
+            void operator()(std::size_t w, std::size_t g) const {
+                Worker &worker = optimizer.workers_[w];
+                if (worker.step != optimizer.needleStep_) {
+                    optimizer.build_evaluators(design, &worker);
+                }
+                optimizer.needle_squares(design, optimizer.groups_[g], optimizer.groups_[g + 1],
+                                         needle, &worker);
+            }
+
+            DesignOptimizer &optimizer;
+            const std::vector<DesignLayer> &design;
+            double needle;
+        };
+
+        Task task = { *this, *design, needle };
+        pool_.parallel_for_worker(groups_.size() - 1, task);
+
+        std::size_t best = 0;
+        for (std::size_t c = 1; c < candidates_.size(); ++c) {
+            if (candidates_[c].merit < candidates_[best].merit) {
+                best = c;
+            }
+        }
+        if (!(candidates_[best].merit < current)) {
+            return false;
+        }
+
+        std::vector<DesignLayer> next;
+        needle_design(*design, candidates_[best], needle, &next);
+        design->swap(next);
+        return true;
+    }
+
+    // Alternate refinements and needle steps until no needle helps or a limit
+    // of the options is reached, returns the merit
+    double optimize(std::vector<DesignLayer> *design, const DesignOptions &options = DesignOptions()) {
+        double result = refine(design, options.refineIterations);
+        for (std::size_t k = 0; k < options.maximumNeedles && design->size() < options.maximumLayers; ++k) {
+            if (!insert_needle(design, options)) {
+                break;
+            }
+            refine(design, options.refineIterations);
+            simplify(design, options.minimumThickness * shortestWavelength_);
+            result = refine(design, options.refineIterations);
+        }
+        return result;
+    }
+
+    // Remove the layers thinner than minimumThickness and merge the adjacent
+    // layers of the same material
+    static void simplify(std::vector<DesignLayer> *design, double minimumThickness) {
+        std::vector<DesignLayer> &layers = *design;
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            if (layers[i].thickness < minimumThickness) {
+                continue;
+            }
+            if (kept > 0 && layers[kept - 1].material == layers[i].material) {
+                layers[kept - 1].thickness += layers[i].thickness;
+            } else {
+                layers[kept++] = layers[i];
+            }
+        }
+        layers.resize(kept);
+    }
+
+private:
+    DesignOptimizer(const DesignOptimizer &);
+    DesignOptimizer &operator=(const DesignOptimizer &);
+
+    // Design at the target j as a stack in unit of wavelength
+    struct TargetStack {
+        std::size_t size() const {
+            return count;
+        }
+
+        Layer operator[](std::size_t i) const {
+            Layer layer;
+            layer.thickness = layers[i].thickness / wavelength;
+            layer.refractiveIndex = refractiveIndices[layers[i].material * targetCount];
+            return layer;
+        }
+
+        const DesignLayer *layers;
+        std::size_t count;
+        double wavelength;
+        // index of the material 0 at the target, the others at a stride of
+        // targetCount
+        const complex *refractiveIndices;
+        std::size_t targetCount;
+    };
+
+    struct Candidate {
+        Candidate(std::size_t layer, double position, std::size_t material)
+            : layer(layer), position(position), material(material), merit(0.0) {
+        }
+
+        // the needle is inserted at the fraction position of the layer, or
+        // after the stack for layer == size
+        std::size_t layer;
+        double position;
+        std::size_t material;
+        double merit;
+    };
+
+    struct alignas(64) Worker {
+        Worker()
+            : step(0) {
+        }
+
+        std::vector<double> derivatives;
+        // the design at every target, as of the needle step step
+        std::vector<StackEvaluator> evaluators;
+        std::size_t step;
+    };
+
+    TargetStack target_stack(const DesignLayer *layers, std::size_t count, std::size_t j) const {
+        TargetStack stack = { layers, count, targets_[j].wavelength, &refractiveIndices_[j], targets_.size() };
+        return stack;
+    }
+
+    // Layer of the design at the target j, in unit of wavelength
+    Layer target_layer(const DesignLayer &layer, std::size_t j) const {
+        Layer result;
+        result.thickness = layer.thickness / targets_[j].wavelength;
+        result.refractiveIndex = refractiveIndices_[layer.material * targets_.size() + j];
+        return result;
+    }
+
+    static double quantity(TargetQuantity quantity, double Rp, double Rs, double Tp, double Ts) {
+        switch (quantity) {
+        case TargetQuantity::ReflectanceP:
+            return Rp;
+        case TargetQuantity::ReflectanceS:
+            return Rs;
+        case TargetQuantity::Reflectance:
+            return 0.5 * (Rp + Rs);
+        case TargetQuantity::TransmittanceP:
+            return Tp;
+        case TargetQuantity::TransmittanceS:
+            return Ts;
+        case TargetQuantity::Transmittance:
+            return 0.5 * (Tp + Ts);
+        }
+        return 0.0;
+    }
+
+    // Weighted residual of the target j
+    double residual(const DesignLayer *layers, std::size_t count, std::size_t j) const {
+        double Rp, Rs, Tp, Ts;
+        reflectance_transmittance(targets_[j].incidentCosTheta, nIncident_[j], nExit_[j],
+                                  target_stack(layers, count, j), &Rp, &Rs, &Tp, &Ts);
+        return weighted_residual(j, Rp, Rs, Tp, Ts);
+    }
+
+    double weighted_residual(std::size_t j, double Rp, double Rs, double Tp, double Ts) const {
+        const DesignTarget &target = targets_[j];
+        return std::sqrt(target.weight) * (quantity(target.quantity, Rp, Rs, Tp, Ts) - target.value);
+    }
+
+    double root_mean(double squares) const {
+        return weightSum_ > 0.0 ? std::sqrt(squares / weightSum_) : 0.0;
+    }
+
+    // Sum of the squared residuals, the targets on the threads
+    double merit_squares(const std::vector<DesignLayer> &design) {
+        struct Task {
+            void operator()(std::size_t j) const {
+                optimizer.residuals_[j] = optimizer.residual(design.data(), design.size(), j);
+            }
+
+            DesignOptimizer &optimizer;
+            const std::vector<DesignLayer> &design;
+        };
+
+        residuals_.resize(targets_.size());
+        Task task = { *this, design };
+        pool_.parallel_for(targets_.size(), task);
+
+        squares_ = 0.0;
+        for (std::size_t j = 0; j < targets_.size(); ++j) {
+            squares_ += residuals_[j] * residuals_[j];
+        }
+        return squares_;
+    }
+
+    void build_evaluators(const std::vector<DesignLayer> &design, Worker *worker) const {
+        worker->evaluators.clear();
+        for (std::size_t j = 0; j < targets_.size(); ++j) {
+            worker->evaluators.push_back(StackEvaluator(targets_[j].incidentCosTheta, nIncident_[j],
+                                                        nExit_[j], target_stack(design.data(),
+                                                                                design.size(), j)));
+        }
+        worker->step = needleStep_;
+    }
+
+    // Sums of the squared residuals of the design with the needles of the
+    // candidates [begin, end) of a group, in their merit. The needle is
+    // inserted in the evaluators of the worker and removed after, as in
+    // needle_design, the positions in the layer only change its two parts.
+    void needle_squares(const std::vector<DesignLayer> &design, std::size_t begin, std::size_t end,
+                        double needle, Worker *worker) {
+        const Candidate &first = candidates_[begin];
+        std::size_t i = first.layer;
+        bool split = first.position > 0.0;
+        for (std::size_t c = begin; c < end; ++c) {
+            candidates_[c].merit = 0.0;
+        }
+
+        for (std::size_t j = 0; j < targets_.size(); ++j) {
+            StackEvaluator &evaluator = worker->evaluators[j];
+            evaluator.insert_layer(i, target_layer(DesignLayer(needle, first.material), j));
+            if (split) {
+                evaluator.insert_layer(i, target_layer(design[i], j));
+            }
+
+            for (std::size_t c = begin; c < end; ++c) {
+                Candidate &candidate = candidates_[c];
+                if (split) {
+                    const DesignLayer &layer = design[i];
+                    DesignLayer before(layer.thickness * candidate.position, layer.material);
+                    DesignLayer after(layer.thickness * (1.0 - candidate.position), layer.material);
+                    evaluator.set_layer(i, target_layer(before, j));
+                    evaluator.set_layer(i + 2, target_layer(after, j));
+                }
+                double Rp, Rs, Tp, Ts;
+                evaluator.reflectance_transmittance(&Rp, &Rs, &Tp, &Ts);
+                double r = weighted_residual(j, Rp, Rs, Tp, Ts);
+                candidate.merit += r * r;
+            }
+
+            if (split) {
+                evaluator.erase_layer(i);
+                evaluator.set_layer(i + 1, target_layer(design[i], j));
+            }
+            evaluator.erase_layer(i);
+        }
+    }
+
+    // Residuals and their derivatives jacobian_[j * N + i] with respect to
+    // the thickness of the layer i
+    void jacobian(const std::vector<DesignLayer> &design) {
+        struct Task {
+            void operator()(std::size_t w, std::size_t j) const {
+                std::size_t N = design.size();
+                const DesignTarget &target = optimizer.targets_[j];
+                std::vector<double> &d = optimizer.workers_[w].derivatives;
+                d.resize(4 * N);
+
+                double Rp, Rs, Tp, Ts;
+                reflectance_transmittance_gradient(target.incidentCosTheta, optimizer.nIncident_[j],
+                                                   optimizer.nExit_[j],
+                                                   optimizer.target_stack(design.data(), N, j),
+                                                   &Rp, &Rs, &Tp, &Ts,
+                                                   LayerDerivatives(&d[0]), LayerDerivatives(&d[N]),
+                                                   LayerDerivatives(&d[2 * N]), LayerDerivatives(&d[3 * N]));
+
+                double scale = std::sqrt(target.weight);
+                optimizer.residuals_[j] = scale * (quantity(target.quantity, Rp, Rs, Tp, Ts) - target.value);
+                // the derivatives are with respect to the thickness in unit of
+                // wavelength
+                scale /= target.wavelength;
+                double *row = &optimizer.jacobian_[j * N];
+                for (std::size_t i = 0; i < N; ++i) {
+                    row[i] = scale * quantity(target.quantity, d[i], d[N + i], d[2 * N + i], d[3 * N + i]);
+                }
+            }
+
+            DesignOptimizer &optimizer;
+            const std::vector<DesignLayer> &design;
+        };
+
+        residuals_.resize(targets_.size());
+        jacobian_.resize(targets_.size() * design.size());
+        Task task = { *this, design };
+        pool_.parallel_for_worker(targets_.size(), task);
+    }
+
+    static void needle_design(const std::vector<DesignLayer> &design, const Candidate &candidate,
+                              double needle, std::vector<DesignLayer> *trial) {
+        trial->clear();
+        if (candidate.layer == design.size()) {
+            trial->insert(trial->end(), design.begin(), design.end());
+            trial->push_back(DesignLayer(needle, candidate.material));
+            return;
+        }
+        const DesignLayer &layer = design[candidate.layer];
+        trial->insert(trial->end(), design.begin(), design.begin() + candidate.layer);
+        if (candidate.position > 0.0) {
+            trial->push_back(DesignLayer(layer.thickness * candidate.position, layer.material));
+        }
+        trial->push_back(DesignLayer(needle, candidate.material));
+        trial->push_back(DesignLayer(layer.thickness * (1.0 - candidate.position), layer.material));
+        trial->insert(trial->end(), design.begin() + candidate.layer + 1, design.end());
+    }
+
+    // Solve A x = b in place for A symmetric positive definite, of which only
+    // the lower triangle is read, false if A is not positive definite
+    static bool solve_cholesky(std::vector<double> *A, std::vector<double> *b, std::size_t N) {
+        std::vector<double> &L = *A;
+        std::vector<double> &x = *b;
+        for (std::size_t i = 0; i < N; ++i) {
+            for (std::size_t j = 0; j <= i; ++j) {
+                double sum = L[i * N + j];
+                for (std::size_t k = 0; k < j; ++k) {
+                    sum -= L[i * N + k] * L[j * N + k];
+                }
+                if (i == j) {
+                    if (!(sum > 0.0)) {
+                        return false;
+                    }
+                    L[i * N + i] = std::sqrt(sum);
+                } else {
+                    L[i * N + j] = sum / L[j * N + j];
+                }
+            }
+        }
+        for (std::size_t i = 0; i < N; ++i) {
+            for (std::size_t k = 0; k < i; ++k) {
+                x[i] -= L[i * N + k] * x[k];
+            }
+            x[i] /= L[i * N + i];
+        }
+        for (std::size_t i = N; i-- > 0;) {
+            for (std::size_t k = i + 1; k < N; ++k) {
+                x[i] -= L[k * N + i] * x[k];
+            }
+            x[i] /= L[i * N + i];
+        }
+        return true;
+    }
+
+    WorkStealingPool &pool_;
+    std::vector<DesignTarget> targets_;
+    std::size_t materialCount_;
+    double shortestWavelength_;
+    double weightSum_;
+    std::vector<complex> nIncident_;
+    std::vector<complex> nExit_;
+    std::vector<complex> refractiveIndices_;
+
+    std::vector<double> residuals_;
+    std::vector<double> jacobian_;
+    double squares_;
+    std::vector<Candidate> candidates_;
+    std::vector<std::size_t> groups_;
+    // insert_needle calls, tells the workers when to rebuild their evaluators
+    std::size_t needleStep_;
+    std::vector<Worker> workers_;
+};
+
+}
+#endif
@@ -0,0 +1,650 @@
+#ifndef THINFILM_DISTRIBUTED_H
+#define THINFILM_DISTRIBUTED_H
+
+#include "thinfilm_catalog.hh"
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+// Evaluation of a catalog on several nodes over TCP (POSIX)
+//
+// The coordinator splits the stacks x wavelengths of a catalog in shards and
+// hands them to the workers that connect to it, a worker evaluates its shards
+// with batch_reflectance_transmittance on all its cores. The results are
+// written into a mapped spectrum file (thinfilm_catalog.hh).
+//
+// A shard is written back to the spectrum file, then marked done in a
+// checkpoint file. A coordinator started again on the same files only
+// evaluates the shards not done yet. The shard of a worker that disconnects
+// or does not answer in time goes back to the queue for the other workers.
+//
+// Messages are a header (uint32 type, uint32 0, uint64 payload size) and a
+// payload of native endian values, the nodes must share the byte order:
+//
+//     Grid    uint64 wavelengthCount, angleCount, double nIncident[2],
+//             nExit[2], wavelengths[], incidentCosTheta[] (real, imaginary)
+//     Shard   uint64 shard, firstStack, stackCount, firstWavelength,
+//             wavelengthCount, layerCount, offsets[stackCount + 1] (from 0),
+//             double thicknesses[layerCount], refractiveIndices[] (pairs)
+//     Result  uint64 shard, double reflectanceP[], reflectanceS[],
+//             transmittanceP[], transmittanceS[], the outputs of
+//             batch_reflectance_transmittance on the shard
+//     Done    no payload, the worker exits
+//
+// Shard and Result payloads are at most maximumShardSize bytes, the
+// coordinator takes fewer stacks per shard than asked when they would not fit.
+
+namespace thinfilm {
+
+enum class MessageType : std::uint32_t {
+    Grid = 1,
+    Shard = 2,
+    Result = 3,
+    Done = 4
+};
+
+struct MessageHeader {
+    std::uint32_t type;
+    std::uint32_t reserved;
+    std::uint64_t size;
+};
+
+// Message payload being built or decoded
+class Message {
+public:
+    Message()
+        : read_(0) {
+    }
+
+    void clear() {
+        data_.clear();
+        read_ = 0;
+    }
+
+    template <class T>
+    void put(const T *values, std::size_t count) {
+        const char *bytes = reinterpret_cast<const char *>(values);
+        data_.insert(data_.end(), bytes, bytes + count * sizeof(T));
+    }
+
+    void put(std::uint64_t value) {
+        put(&value, 1);
+    }
+
+    // false past the end of the payload
+    template <class T>
+    bool get(T *values, std::size_t count) {
+        if (count > (data_.size() - read_) / sizeof(T)) {
+            return false;
+        }
+        std::memcpy(values, &data_[read_], count * sizeof(T));
+        read_ += count * sizeof(T);
+        return true;
+    }
+
+    bool get(std::uint64_t *value) {
+        return get(value, 1);
+    }
+
+    // Values read in place, valid until the payload changes
+    template <class T>
+    const T *view(std::size_t count) {
+        if (count > (data_.size() - read_) / sizeof(T)) {
+            return 0;
+        }
+        const T *values = reinterpret_cast<const T *>(&data_[read_]);
+        read_ += count * sizeof(T);
+        return values;
+    }
+
+    std::vector<char> &data() {
+        return data_;
+    }
+
+    bool finished() const {
+        return read_ == data_.size();
+    }
+
+private:
+    std::vector<char> data_;
+    std::size_t read_;
+};
+
+inline bool send_all(int fd, const void *data, std::size_t size) {
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= std::size_t(sent);
+    }
+    return true;
+}
+
+inline bool recv_all(int fd, void *data, std::size_t size) {
+    char *bytes = static_cast<char *>(data);
+    while (size > 0) {
+        ssize_t received = recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= std::size_t(received);
+    }
+    return true;
+}
+
+inline bool send_message(int fd, MessageType type, Message &message) {
+    MessageHeader header = { std::uint32_t(type), 0, message.data().size() };
+    return send_all(fd, &header, sizeof(header)) &&
+           send_all(fd, message.data().data(), message.data().size());
+}
+
+// Receive a message of at most maximumSize bytes
+inline bool recv_message(int fd, MessageType *type, Message *message, std::uint64_t maximumSize) {
+    MessageHeader header;
+    if (!recv_all(fd, &header, sizeof(header)) || header.size > maximumSize) {
+        return false;
+    }
+    message->clear();
+    message->data().resize(header.size);
+    *type = MessageType(header.type);
+    return recv_all(fd, message->data().data(), header.size);
+}
+
+// Append size bytes of payload to message
+inline bool recv_payload(int fd, std::size_t size, Message *message) {
+    std::size_t read = message->data().size();
+    message->data().resize(read + size);
+    return recv_all(fd, message->data().data() + read, size);
+}
+
+// Largest Shard and Result payloads, the coordinator makes its shards small
+// enough and a worker rejects the larger ones
+const std::uint64_t maximumShardSize = std::uint64_t(1) << 32;
+
+// Largest wavelengthCount, angleCount and their product in a Grid, as in a
+// spectrum file
+const std::uint64_t maximumGridCount = std::uint64_t(1) << 28;
+
+// Split of the stacks x wavelengths of a catalog in shards
+struct ShardPlan {
+    ShardPlan(std::size_t stackCount, std::size_t wavelengthCount,
+              std::size_t stacksPerShard, std::size_t wavelengthsPerShard)
+        : stackCount(stackCount), wavelengthCount(wavelengthCount),
+          stacksPerShard(std::max<std::size_t>(stacksPerShard, 1)),
+          wavelengthsPerShard(std::max<std::size_t>(std::min(wavelengthsPerShard, wavelengthCount), 1)) {
+        stackBlocks = (stackCount + this->stacksPerShard - 1) / this->stacksPerShard;
+        wavelengthBlocks = (wavelengthCount + this->wavelengthsPerShard - 1) / this->wavelengthsPerShard;
+    }
+
+    std::size_t size() const {
+        return stackBlocks * wavelengthBlocks;
+    }
+
+    void shard(std::size_t i, std::size_t *firstStack, std::size_t *stacks,
+               std::size_t *firstWavelength, std::size_t *wavelengths) const {
+        *firstStack = i / wavelengthBlocks * stacksPerShard;
+        *stacks = std::min(stacksPerShard, stackCount - *firstStack);
+        *firstWavelength = i % wavelengthBlocks * wavelengthsPerShard;
+        *wavelengths = std::min(wavelengthsPerShard, wavelengthCount - *firstWavelength);
+    }
+
+    std::size_t stackCount;
+    std::size_t wavelengthCount;
+    std::size_t stacksPerShard;
+    std::size_t wavelengthsPerShard;
+    std::size_t stackBlocks;
+    std::size_t wavelengthBlocks;
+};
+
+// Hash of the layout of a catalog, its stack count and offsets
+inline std::uint64_t catalog_layout_hash(const StackCatalog &catalog) {
+    std::uint64_t hash = catalog.size();
+    const std::size_t *offsets = catalog.offsets();
+    for (std::size_t s = 0; s <= catalog.size(); ++s) {
+        hash = (hash ^ offsets[s]) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// Mapped file of one byte per shard, 1 once the shard is in the spectra
+//
+//     char    magic[8] "TFCHKPT1"
+//     uint64  runId of the spectra, catalog_layout_hash of the catalog,
+//             stackCount, wavelengthCount, angleCount, stacksPerShard,
+//             wavelengthsPerShard, shardCount
+//     char    done[shardCount]
+class Checkpoint {
+public:
+    static const std::size_t headerSize = 72;
+
+    // Open the checkpoint of plan on the spectra runId and the catalog
+    // catalogHash, or create it with no shard done
+    //
+    // A checkpoint of another runId was left by an earlier creation of the
+    // spectra and is created again. False if it is one of the same spectra
+    // for another catalog or plan.
+    bool open(const char *path, const ShardPlan &plan, std::size_t angleCount,
+              std::uint64_t runId, std::uint64_t catalogHash) {
+        std::uint64_t header[8] = { runId, catalogHash, plan.stackCount, plan.wavelengthCount, angleCount,
+                                    plan.stacksPerShard, plan.wavelengthsPerShard, plan.size() };
+        if (file_.open(path, true) && file_.size() >= headerSize && std::memcmp(file_.data(), "TFCHKPT1", 8) == 0 &&
+            std::memcmp(file_.data() + 8, &runId, sizeof(runId)) == 0) {
+            return file_.size() == headerSize + plan.size() &&
+                   std::memcmp(file_.data() + 8, header, sizeof(header)) == 0;
+        }
+        if (!file_.create(path, headerSize + plan.size())) {
+            return false;
+        }
+        std::memcpy(file_.data(), "TFCHKPT1", 8);
+        std::memcpy(file_.data() + 8, header, sizeof(header));
+        return file_.sync();
+    }
+
+    bool done(std::size_t shard) const {
+        return file_.data()[headerSize + shard] != 0;
+    }
+
+    bool mark_done(std::size_t shard) {
+        file_.data()[headerSize + shard] = 1;
+        return file_.sync(headerSize + shard, 1);
+    }
+
+private:
+    MappedFile file_;
+};
+
+struct CoordinatorOptions {
+    CoordinatorOptions()
+        : stacksPerShard(65536), wavelengthsPerShard(std::size_t(-1)), shardTimeout(600) {
+    }
+
+    std::size_t stacksPerShard;
+    std::size_t wavelengthsPerShard;
+    // seconds to wait for the result of a shard, or for the acknowledgment
+    // of data sent, before giving up on the worker. 0 waits forever, which a
+    // node lost without closing its connection blocks.
+    int shardTimeout;
+};
+
+// Detect a peer lost without closing the connection (power loss, network
+// partition): keepalive probes after a minute of silence, and if timeout
+// seconds are not 0, a limit on the time sent data stays unacknowledged
+inline void set_connection_options(int fd, int timeout) {
+    int on = 1;
+    int idle = 60;
+    int interval = 10;
+    int probes = 6;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+    if (timeout > 0) {
+        unsigned int milliseconds = unsigned(timeout) * 1000u;
+        setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &milliseconds, sizeof(milliseconds));
+    }
+}
+
+// Socket listening on port of all the interfaces, -1 on error
+inline int listen_tcp(int port) {
+    int fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    int off = 0;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+
+    sockaddr_in6 address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(std::uint16_t(port));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 64) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Socket connected to host:port, -1 on error
+inline int connect_tcp(const char *host, const char *port) {
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = 0;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *a = addresses; a != 0 && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd >= 0) {
+        // a worker waits for shards as long as the coordinator is alive
+        set_connection_options(fd, 0);
+    }
+    return fd;
+}
+
+// Coordinator of the evaluation of a catalog into a writable spectrum file
+//
+// Serves the workers connecting to the listening socket until all the shards
+// are in the spectra and marked in the checkpoint. Returns false if the
+// spectra do not match the catalog or the checkpoint, or if writing fails.
+class Coordinator {
+public:
+    Coordinator(const StackCatalog &catalog, SpectrumFile *spectra,
+                const CoordinatorOptions &options = CoordinatorOptions())
+        : catalog_(catalog), spectra_(*spectra), options_(options),
+          plan_(catalog.size(), spectra->wavelength_count(),
+                shard_stacks(options, spectra->wavelength_count(), spectra->angle_count()),
+                options.wavelengthsPerShard),
+          remaining_(0), failed_(false) {
+    }
+
+    bool run(int listenFd, const char *checkpointPath) {
+        if (catalog_.size() != spectra_.size() || !spectra_.file().writable() ||
+            !checkpoint_.open(checkpointPath, plan_, spectra_.angle_count(), spectra_.run_id(),
+                              catalog_layout_hash(catalog_))) {
+            return false;
+        }
+        // the layers of every shard fit in a Shard message
+        for (std::size_t i = 0; i < plan_.size(); ++i) {
+            std::size_t firstStack, stackCount, firstWavelength, wavelengthCount;
+            plan_.shard(i, &firstStack, &stackCount, &firstWavelength, &wavelengthCount);
+            const std::size_t *offsets = catalog_.offsets() + firstStack;
+            if (48 + 8 * (stackCount + 1) + 24 * (offsets[stackCount] - offsets[0]) > maximumShardSize) {
+                return false;
+            }
+        }
+        for (std::size_t i = 0; i < plan_.size(); ++i) {
+            if (!checkpoint_.done(i)) {
+                queue_.push_back(i);
+            }
+        }
+        remaining_ = queue_.size();
+
+        std::vector<std::thread> connections;
+        for (;;) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (remaining_ == 0 || failed_) {
+                    break;
+                }
+            }
+            pollfd listening = { listenFd, POLLIN, 0 };
+            if (poll(&listening, 1, 200) <= 0) {
+                continue;
+            }
+            int fd = accept(listenFd, 0, 0);
+            if (fd >= 0) {
+                connections.push_back(std::thread(&Coordinator::serve, this, fd));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            // wake the connections waiting for a shard
+            failed_ = failed_ || remaining_ != 0;
+        }
+        changed_.notify_all();
+        for (std::size_t t = 0; t < connections.size(); ++t) {
+            connections[t].join();
+        }
+        return !failed_;
+    }
+
+    // shards still to evaluate
+    std::size_t remaining() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return remaining_;
+    }
+
+private:
+    Coordinator(const Coordinator &);
+    Coordinator &operator=(const Coordinator &);
+
+    // stacksPerShard, reduced so that the results of a shard fit in a message
+    static std::size_t shard_stacks(const CoordinatorOptions &options, std::size_t wavelengthCount,
+                                    std::size_t angleCount) {
+        std::size_t wavelengths = std::max<std::size_t>(std::min(options.wavelengthsPerShard, wavelengthCount), 1);
+        std::size_t stacks = (maximumShardSize - 8) / 32 / (wavelengths * std::max<std::size_t>(angleCount, 1));
+        return std::max<std::size_t>(std::min(options.stacksPerShard, stacks), 1);
+    }
+
+    // One connection to a worker
+    void serve(int fd) {
+        if (options_.shardTimeout > 0) {
+            timeval timeout = { options_.shardTimeout, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        }
+        set_connection_options(fd, options_.shardTimeout);
+
+        Message message;
+        message.put(std::uint64_t(spectra_.wavelength_count()));
+        message.put(std::uint64_t(spectra_.angle_count()));
+        complex media[2] = { spectra_.n_incident(), spectra_.n_exit() };
+        message.put(media, 2);
+        message.put(spectra_.wavelengths(), spectra_.wavelength_count());
+        message.put(spectra_.incident_cos_theta(), spectra_.angle_count());
+        bool connected = send_message(fd, MessageType::Grid, message);
+
+        while (connected) {
+            std::size_t shard;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                changed_.wait(lock, [this] { return !queue_.empty() || remaining_ == 0 || failed_; });
+                if (failed_ || queue_.empty()) {
+                    break;
+                }
+                shard = queue_.front();
+                queue_.pop_front();
+            }
+
+            if (!evaluate_remotely(fd, shard, &message)) {
+                // back to the queue for another worker
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push_front(shard);
+                connected = false;
+            }
+            changed_.notify_all();
+        }
+
+        bool finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished = !failed_ && remaining_ == 0;
+        }
+        // after a failure the workers see the connection close instead
+        if (connected && finished) {
+            message.clear();
+            send_message(fd, MessageType::Done, message);
+        }
+        ::close(fd);
+    }
+
+    bool evaluate_remotely(int fd, std::size_t shard, Message *message) {
+        std::size_t firstStack, stackCount, firstWavelength, wavelengthCount;
+        plan_.shard(shard, &firstStack, &stackCount, &firstWavelength, &wavelengthCount);
+
+        const std::size_t *offsets = catalog_.offsets() + firstStack;
+        std::size_t firstLayer = offsets[0];
+        std::size_t layerCount = offsets[stackCount] - firstLayer;
+
+        message->clear();
+        message->put(std::uint64_t(shard));
+        message->put(std::uint64_t(firstStack));
+        message->put(std::uint64_t(stackCount));
+        message->put(std::uint64_t(firstWavelength));
+        message->put(std::uint64_t(wavelengthCount));
+        message->put(std::uint64_t(layerCount));
+        for (std::size_t s = 0; s <= stackCount; ++s) {
+            message->put(std::uint64_t(offsets[s] - firstLayer));
+        }
+        message->put(catalog_.thicknesses() + firstLayer, layerCount);
+        message->put(catalog_.refractive_indices() + firstLayer, layerCount);
+        if (!send_message(fd, MessageType::Shard, *message)) {
+            return false;
+        }
+
+        std::size_t angleCount = spectra_.angle_count();
+        std::size_t values = stackCount * wavelengthCount * angleCount;
+        MessageType type;
+        if (!recv_message(fd, &type, message, 8 + 4 * 8 * values)) {
+            return false;
+        }
+        std::uint64_t answered;
+        if (type != MessageType::Result || message->data().size() != 8 + 4 * 8 * values ||
+            !message->get(&answered) || answered != shard) {
+            return false;
+        }
+
+        // the shard covers a block of every stack of every column
+        std::size_t W = spectra_.wavelength_count();
+        std::size_t block = wavelengthCount * angleCount;
+        bool written = true;
+        for (std::size_t c = 0; c < 4; ++c) {
+            const double *results = message->view<double>(values);
+            double *column = spectra_.column(c);
+            for (std::size_t s = 0; s < stackCount; ++s) {
+                double *out = column + ((firstStack + s) * W + firstWavelength) * angleCount;
+                std::copy(results + s * block, results + (s + 1) * block, out);
+            }
+            std::size_t begin = reinterpret_cast<char *>(column + firstStack * W * angleCount) -
+                                spectra_.file().data();
+            written = spectra_.file().sync(begin, stackCount * W * angleCount * sizeof(double)) && written;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!written || !checkpoint_.mark_done(shard)) {
+            failed_ = true;
+        } else {
+            --remaining_;
+        }
+        return true;
+    }
+
+    const StackCatalog &catalog_;
+    SpectrumFile &spectra_;
+    CoordinatorOptions options_;
+    ShardPlan plan_;
+    Checkpoint checkpoint_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::deque<std::size_t> queue_;
+    std::size_t remaining_;
+    bool failed_;
+};
+
+// Worker evaluating the shards of a coordinator on pool until it is done
+// Returns false if the connection fails or a message is invalid.
+//
+// The counts at the start of a Grid or a Shard are read first, the rest of
+// the payload is allocated once its size matches them.
+inline bool run_worker(int fd, WorkStealingPool &pool) {
+    Message message, result;
+    MessageHeader header;
+    if (!recv_all(fd, &header, sizeof(header)) || MessageType(header.type) != MessageType::Grid ||
+        header.size < 48 || !recv_payload(fd, 48, &message)) {
+        return false;
+    }
+    std::uint64_t W, A;
+    complex media[2];
+    if (!message.get(&W) || !message.get(&A) || !message.get(media, 2) ||
+        W >= maximumGridCount || A >= maximumGridCount || W * A >= maximumGridCount ||
+        header.size != 48 + 8 * W + 16 * A || !recv_payload(fd, header.size - 48, &message)) {
+        return false;
+    }
+    std::vector<double> wavelengths(W);
+    std::vector<complex> incidentCosTheta(A);
+    message.get(wavelengths.data(), W);
+    message.get(incidentCosTheta.data(), A);
+
+    std::vector<std::size_t> offsets;
+    std::vector<double> thicknesses;
+    std::vector<complex> refractiveIndices;
+    for (;;) {
+        if (!recv_all(fd, &header, sizeof(header))) {
+            return false;
+        }
+        if (MessageType(header.type) == MessageType::Done) {
+            return header.size == 0;
+        }
+        message.clear();
+        std::uint64_t shard, firstStack, stackCount, firstWavelength, wavelengthCount, layerCount;
+        if (MessageType(header.type) != MessageType::Shard || header.size < 48 ||
+            header.size > maximumShardSize || !recv_payload(fd, 48, &message) ||
+            !message.get(&shard) || !message.get(&firstStack) || !message.get(&stackCount) ||
+            !message.get(&firstWavelength) || !message.get(&wavelengthCount) || !message.get(&layerCount)) {
+            return false;
+        }
+        // the counts are below maximumShardSize, no product overflows
+        if (stackCount >= header.size / 8 || layerCount > header.size / 24 ||
+            header.size != 48 + 8 * (stackCount + 1) + 24 * layerCount ||
+            firstWavelength > W || wavelengthCount > W - firstWavelength ||
+            8 + 32 * stackCount * wavelengthCount * A > maximumShardSize ||
+            !recv_payload(fd, header.size - 48, &message)) {
+            return false;
+        }
+        offsets.resize(stackCount + 1);
+        thicknesses.resize(layerCount);
+        refractiveIndices.resize(layerCount);
+        message.get(offsets.data(), stackCount + 1);
+        message.get(thicknesses.data(), layerCount);
+        message.get(refractiveIndices.data(), layerCount);
+        if (offsets[0] != 0 || offsets[stackCount] != layerCount) {
+            return false;
+        }
+        for (std::size_t s = 0; s < stackCount; ++s) {
+            if (offsets[s + 1] < offsets[s]) {
+                return false;
+            }
+        }
+
+        std::size_t values = stackCount * wavelengthCount * A;
+        result.clear();
+        result.put(shard);
+        result.data().resize(8 + 4 * 8 * values);
+        double *outputs = reinterpret_cast<double *>(result.data().data() + 8);
+        batch_reflectance_transmittance(pool, media[0], media[1],
+                                        StackArenaView(offsets.data(), stackCount, thicknesses.data(),
+                                                       refractiveIndices.data()),
+                                        wavelengths.data() + firstWavelength, wavelengthCount,
+                                        incidentCosTheta.data(), A,
+                                        outputs, outputs + values, outputs + 2 * values, outputs + 3 * values);
+        if (!send_message(fd, MessageType::Result, result)) {
+            return false;
+        }
+    }
+}
+
+}
+#endif
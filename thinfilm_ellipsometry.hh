@@ -0,0 +1,163 @@
+#ifndef THINFILM_ELLIPSOMETRY_H
+#define THINFILM_ELLIPSOMETRY_H
+
+#include "thinfilm.hh"
+
+// Complex amplitude coefficients and ellipsometric angles
+//
+// The same pass as transfer keeps r = m21 / m11 and t = 1 / m11 complex
+// instead of taking their norms. The ellipsometric ratio is
+//
+//     rho = rp / rs = tan(psi) exp(i delta)
+//
+// with rp in the convention of most ellipsometers, where rp = -rs at normal
+// incidence (delta = pi below the Brewster angle of a bare substrate). The
+// amplitudes returned are those of the kernels, in which rp = rs at normal
+// incidence: rho = -rP / rS.
+
+namespace thinfilm {
+
+// Outputs of the ellipsometry functions, a null array is not computed
+struct EllipsometryOutput {
+    EllipsometryOutput()
+        : psi(0), delta(0), rP(0), rS(0), tP(0), tS(0) {
+    }
+    EllipsometryOutput(double *psi, double *delta, complex *rP = 0, complex *rS = 0,
+                       complex *tP = 0, complex *tS = 0)
+        : psi(psi), delta(delta), rP(rP), rS(rS), tP(tP), tS(tS) {
+    }
+
+    // in radians, psi in [0, pi / 2] and delta in [-pi, pi]
+    double *psi;
+    double *delta;
+    // amplitude coefficients of the tangential fields, as in transfer
+    complex *rP;
+    complex *rS;
+    complex *tP;
+    complex *tS;
+};
+
+// psi and delta of the amplitude coefficients
+inline void ellipsometric_angles(complex rP, complex rS, double *psi, double *delta) {
+    complex rho = -rP / rS;
+    *psi = std::atan2(std::abs(rP), std::abs(rS));
+    *delta = std::arg(rho);
+}
+
+// Store the values of the index out of the first columns of C_1 ... C_N B
+inline void store_ellipsometry(const Column2 &vP, const Column2 &vS,
+                               complex incidentCosTheta, complex nIncident,
+                               const EllipsometryOutput &output, std::size_t out) {
+    // left multiply by A_0p and A_0s
+    complex scale = 2.0 * nIncident * incidentCosTheta;
+    complex m11P = (nIncident * vP.m11 + incidentCosTheta * vP.m21) / scale;
+    complex m21P = (nIncident * vP.m11 - incidentCosTheta * vP.m21) / scale;
+    complex m11S = (nIncident * incidentCosTheta * vS.m11 + vS.m21) / scale;
+    complex m21S = (nIncident * incidentCosTheta * vS.m11 - vS.m21) / scale;
+
+    complex rP = m21P / m11P;
+    complex rS = m21S / m11S;
+    if (output.psi || output.delta) {
+        double psi, delta;
+        ellipsometric_angles(rP, rS, &psi, &delta);
+        if (output.psi) {
+            output.psi[out] = psi;
+        }
+        if (output.delta) {
+            output.delta[out] = delta;
+        }
+    }
+    if (output.rP) {
+        output.rP[out] = rP;
+    }
+    if (output.rS) {
+        output.rS[out] = rS;
+    }
+    if (output.tP) {
+        output.tP[out] = 1.0 / m11P;
+    }
+    if (output.tS) {
+        output.tS[out] = 1.0 / m11S;
+    }
+}
+
+// Carry the first columns of B_p and B_s through the layers
+inline void ellipsometry_columns(const LayerInvariants *layers, std::size_t layerCount,
+                                 complex nSinThetaSquared, complex nExit, Column2 *vP, Column2 *vS) {
+    complex exitCosTheta = std::sqrt(1.0 - nSinThetaSquared / (nExit * nExit));
+    *vP = Column2(exitCosTheta, nExit);
+    *vS = Column2(1.0, nExit * exitCosTheta);
+
+    for (std::size_t i = layerCount; i-- > 0;) {
+        const LayerInvariants &layer = layers[i];
+        complex cosTheta = std::sqrt(1.0 - nSinThetaSquared * layer.inverseNSquared);
+        complex inverseCosTheta = 1.0 / cosTheta;
+
+        complex deltaLayer = layer.phase * cosTheta;
+        complex c, s;
+        sincos(deltaLayer, &c, &s);
+        complex js = complex(0.0, -1.0) * s;
+
+        vP->left_multiply_layer(c, js * cosTheta * layer.inverseN, js * layer.n * inverseCosTheta);
+        vS->left_multiply_layer(c, js * inverseCosTheta * layer.inverseN, js * layer.n * cosTheta);
+    }
+}
+
+// Ellipsometry of a stack at one incidence angle, the arrays of output hold
+// one value
+// nIncident * incidentSinTheta MUST be real
+template <class Stack>
+void ellipsometry(complex incidentCosTheta, complex nIncident, complex nExit, const Stack &layers,
+                  const EllipsometryOutput &output) {
+    std::vector<LayerInvariants> invariants(layers.size());
+    for (std::size_t i = 0; i < layers.size(); ++i) {
+        invariants[i] = LayerInvariants(layers[i]);
+    }
+    complex nSinThetaSquared = (1.0 - incidentCosTheta * incidentCosTheta) * (nIncident * nIncident);
+
+    Column2 vP, vS;
+    ellipsometry_columns(invariants.data(), invariants.size(), nSinThetaSquared, nExit, &vP, &vS);
+    store_ellipsometry(vP, vS, incidentCosTheta, nIncident, output, 0);
+}
+
+// Ellipsometric spectra of a stack over a grid of wavelengths and angles
+//
+// The stack is given as for spectral_reflectance_transmittance: thicknesses
+// in the unit of the wavelengths, refractiveIndices[i * wavelengthCount + k],
+// nIncident[k] and nExit[k]. The quantities of the layers that do not depend
+// on the angle are computed once per wavelength.
+// nIncident[k] * incidentSinTheta MUST be real
+// The arrays of output hold wavelengthCount * angleCount values, the result
+// of (wavelengths[k], incidentCosTheta[a]) at k * angleCount + a.
+inline void spectral_ellipsometry(const complex *incidentCosTheta, std::size_t angleCount,
+                                  const complex *nIncident, const complex *nExit,
+                                  const double *thicknesses, std::size_t layerCount,
+                                  const complex *refractiveIndices,
+                                  const double *wavelengths, std::size_t wavelengthCount,
+                                  const EllipsometryOutput &output) {
+    THINFILM_COUNT(Sweeps, 1);
+    THINFILM_COUNT(Evaluations, wavelengthCount * angleCount);
+    THINFILM_COUNT(LayerEvaluations, layerCount * wavelengthCount * angleCount);
+
+    std::vector<LayerInvariants> invariants(layerCount);
+    for (std::size_t k = 0; k < wavelengthCount; ++k) {
+        for (std::size_t i = 0; i < layerCount; ++i) {
+            Layer layer;
+            layer.thickness = thicknesses[i] / wavelengths[k];
+            layer.refractiveIndex = refractiveIndices[i * wavelengthCount + k];
+            invariants[i] = LayerInvariants(layer);
+        }
+        complex nIncidentSquared = nIncident[k] * nIncident[k];
+
+        for (std::size_t a = 0; a < angleCount; ++a) {
+            complex nSinThetaSquared = (1.0 - incidentCosTheta[a] * incidentCosTheta[a]) * nIncidentSquared;
+
+            Column2 vP, vS;
+            ellipsometry_columns(invariants.data(), layerCount, nSinThetaSquared, nExit[k], &vP, &vS);
+            store_ellipsometry(vP, vS, incidentCosTheta[a], nIncident[k], output, k * angleCount + a);
+        }
+    }
+}
+
+}
+#endif
@@ -0,0 +1,235 @@
+#ifndef THINFILM_EVALUATOR_H
+#define THINFILM_EVALUATOR_H
+
+#include "thinfilm.hh"
+#include <cstdint>
+
+namespace thinfilm {
+
+// Stack evaluator for local modifications at a fixed incidence
+//
+// The layers are kept in an implicit treap (a randomized balanced binary tree
+// ordered by position), every node caches the product of the layer matrices
+// of its subtree. Changing, inserting or erasing a layer only recomputes the
+// products along one path: O(log N) matrix products instead of O(N).
+// The nodes live in a pool that is reused, the modifications do not allocate
+// once the pool has grown to the size of the stack.
+class StackEvaluator {
+public:
+    // The layers have their thickness in unit of wavelength, as in Layer
+    // nIncident * incidentSinTheta MUST be real
+    template <class Stack>
+    StackEvaluator(complex incidentCosTheta, complex nIncident, complex nExit,
+                   const Stack &layers)
+        : incidentCosTheta_(incidentCosTheta), nIncident_(nIncident), nExit_(nExit),
+          nSinThetaSquared_((1.0 - incidentCosTheta * incidentCosTheta) * (nIncident * nIncident)),
+          root_(NIL), free_(NIL), seed_(0x9E3779B97F4A7C15ull) {
+        nodes_.reserve(layers.size());
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            root_ = merge(root_, new_node(layers[i]));
+        }
+    }
+
+    std::size_t size() const {
+        return count(root_);
+    }
+
+    const Layer &layer(std::size_t i) const {
+        return nodes_[find(i)].layer;
+    }
+
+    // Replace the layer i
+    void set_layer(std::size_t i, const Layer &layer) {
+        set_layer(root_, i, layer);
+    }
+
+    // Insert a layer before the layer i, i == size() appends it
+    void insert_layer(std::size_t i, const Layer &layer) {
+        std::size_t left, right;
+        split(root_, i, &left, &right);
+        root_ = merge(merge(left, new_node(layer)), right);
+    }
+
+    // Remove the layer i
+    void erase_layer(std::size_t i) {
+        std::size_t left, middle, right;
+        split(root_, i, &left, &right);
+        split(right, 1, &middle, &right);
+        nodes_[middle].left = free_;
+        free_ = middle;
+        root_ = merge(left, right);
+    }
+
+    // Same as thinfilm::transfer_matrix_PS for the current layers
+    std::pair<Matrix22, Matrix22> transfer_matrix_PS() const {
+        Matrix22 MatP, MatS;
+        incident_matrices_PS(incidentCosTheta_, nIncident_, &MatP, &MatS);
+        if (root_ != NIL) {
+            MatP *= nodes_[root_].productP;
+            MatS *= nodes_[root_].productS;
+        }
+        multiply_exit_PS(nSinThetaSquared_, nExit_, &MatP, &MatS);
+        return std::pair<Matrix22, Matrix22>(MatP, MatS);
+    }
+
+    void reflectance_transmittance(double *reflectanceP, double *reflectanceS,
+                                   double *transmittanceP, double *transmittanceS) const {
+        Matrix22 MatP, MatS;
+        incident_matrices_PS(incidentCosTheta_, nIncident_, &MatP, &MatS);
+        if (root_ != NIL) {
+            MatP *= nodes_[root_].productP;
+            MatS *= nodes_[root_].productS;
+        }
+        complex exitCosTheta = multiply_exit_PS(nSinThetaSquared_, nExit_, &MatP, &MatS);
+
+        power_coefficients_PS(MatP, MatS, incidentCosTheta_, nIncident_, exitCosTheta, nExit_,
+                              reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+    }
+
+    void reflectance(double *reflectanceP, double *reflectanceS) const {
+        double transmittanceP, transmittanceS;
+        reflectance_transmittance(reflectanceP, reflectanceS, &transmittanceP, &transmittanceS);
+    }
+
+private:
+    static const std::size_t NIL = ~std::size_t(0);
+
+    struct Node {
+        Layer layer;
+        // layer matrices
+        Matrix22 CP;
+        Matrix22 CS;
+        // products of the layer matrices of the subtree, in stack order
+        Matrix22 productP;
+        Matrix22 productS;
+        std::size_t count;
+        std::uint64_t priority;
+        std::size_t left;
+        std::size_t right;
+    };
+
+    std::size_t count(std::size_t x) const {
+        return x == NIL ? 0 : nodes_[x].count;
+    }
+
+    std::size_t new_node(const Layer &layer) {
+        std::size_t x;
+        if (free_ != NIL) {
+            x = free_;
+            free_ = nodes_[x].left;
+        } else {
+            x = nodes_.size();
+            nodes_.push_back(Node());
+        }
+
+        // xorshift64*
+        seed_ ^= seed_ >> 12;
+        seed_ ^= seed_ << 25;
+        seed_ ^= seed_ >> 27;
+
+        Node &node = nodes_[x];
+        node.priority = seed_ * 0x2545F4914F6CDD1Dull;
+        node.left = node.right = NIL;
+        set_matrices(x, layer);
+        update(x);
+        return x;
+    }
+
+    void set_matrices(std::size_t x, const Layer &layer) {
+        Node &node = nodes_[x];
+        node.layer = layer;
+        layer_matrices_PS(layer.refractiveIndex, nSinThetaSquared_, 2.0 * M_PI * layer.thickness,
+                          &node.CP, &node.CS);
+    }
+
+    void update(std::size_t x) {
+        Node &node = nodes_[x];
+        node.count = 1 + count(node.left) + count(node.right);
+        if (node.left != NIL) {
+            node.productP = nodes_[node.left].productP * node.CP;
+            node.productS = nodes_[node.left].productS * node.CS;
+        } else {
+            node.productP = node.CP;
+            node.productS = node.CS;
+        }
+        if (node.right != NIL) {
+            node.productP *= nodes_[node.right].productP;
+            node.productS *= nodes_[node.right].productS;
+        }
+    }
+
+    std::size_t find(std::size_t i) const {
+        std::size_t x = root_;
+        for (;;) {
+            std::size_t leftCount = count(nodes_[x].left);
+            if (i < leftCount) {
+                x = nodes_[x].left;
+            } else if (i == leftCount) {
+                return x;
+            } else {
+                i -= leftCount + 1;
+                x = nodes_[x].right;
+            }
+        }
+    }
+
+    void set_layer(std::size_t x, std::size_t i, const Layer &layer) {
+        std::size_t leftCount = count(nodes_[x].left);
+        if (i < leftCount) {
+            set_layer(nodes_[x].left, i, layer);
+        } else if (i == leftCount) {
+            set_matrices(x, layer);
+        } else {
+            set_layer(nodes_[x].right, i - leftCount - 1, layer);
+        }
+        update(x);
+    }
+
+    // left receives the first i layers of x, right the others
+    void split(std::size_t x, std::size_t i, std::size_t *left, std::size_t *right) {
+        if (x == NIL) {
+            *left = *right = NIL;
+            return;
+        }
+        std::size_t leftCount = count(nodes_[x].left);
+        if (i <= leftCount) {
+            split(nodes_[x].left, i, left, &nodes_[x].left);
+            *right = x;
+        } else {
+            split(nodes_[x].right, i - leftCount - 1, &nodes_[x].right, right);
+            *left = x;
+        }
+        update(x);
+    }
+
+    std::size_t merge(std::size_t left, std::size_t right) {
+        if (left == NIL) {
+            return right;
+        }
+        if (right == NIL) {
+            return left;
+        }
+        if (nodes_[left].priority > nodes_[right].priority) {
+            nodes_[left].right = merge(nodes_[left].right, right);
+            update(left);
+            return left;
+        }
+        nodes_[right].left = merge(left, nodes_[right].left);
+        update(right);
+        return right;
+    }
+
+    complex incidentCosTheta_;
+    complex nIncident_;
+    complex nExit_;
+    complex nSinThetaSquared_;
+
+    std::vector<Node> nodes_;
+    std::size_t root_;
+    // chain of the erased nodes through Node::left
+    std::size_t free_;
+    std::uint64_t seed_;
+};
+
+}
+#endif
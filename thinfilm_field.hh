@@ -0,0 +1,168 @@
+#ifndef THINFILM_FIELD_H
+#define THINFILM_FIELD_H
+
+#include "thinfilm.hh"
+#include <algorithm>
+
+// Electric field and absorbed power inside a stack
+//
+// The first column of C_i+1 ... C_N B is the tangential field (E, H) at the
+// bottom of the layer i for a transmitted wave of amplitude 1. One backward
+// pass stores it at every interface, as in reflectance_transmittance_gradient,
+// and 1 / m11 scales it to an incident wave of amplitude 1. The field at the
+// depth z in the layer i is the field at its bottom times the layer matrix of
+// the remaining thickness, so a profile costs one layer matrix per depth on
+// top of one evaluation of R and T.
+
+namespace thinfilm {
+
+// Outputs of field_profile_PS for one polarization, a null array is not
+// computed
+struct FieldProfile {
+    FieldProfile()
+        : intensity(0), absorption(0), layerAbsorptance(0) {
+    }
+    FieldProfile(double *intensity, double *absorption = 0, double *layerAbsorptance = 0)
+        : intensity(intensity), absorption(absorption), layerAbsorptance(layerAbsorptance) {
+    }
+
+    // |E|^2 at every depth, relative to the incident wave
+    double *intensity;
+    // power absorbed per unit of depth at every depth, relative to the
+    // incident power, the depth in the unit of the stack
+    double *absorption;
+    // fraction of the incident power absorbed in every layer, together with
+    // R and T it sums to 1
+    double *layerAbsorptance;
+};
+
+// Fields at depthCount depths of a stack, for both polarizations
+//
+// depths[k] is measured from the first interface in the unit of the
+// thicknesses (unit of wavelength), in any order. A negative depth is in the
+// incident medium (incident and reflected waves), a depth beyond the last
+// interface is in the exit medium.
+// nIncident * incidentSinTheta MUST be real
+template <class Stack>
+void field_profile_PS(complex incidentCosTheta, complex nIncident, complex nExit,
+                      const Stack &layers, const double *depths, std::size_t depthCount,
+                      const FieldProfile &profileP, const FieldProfile &profileS) {
+    // nIncident * incidentSinTheta MUST be real, see
+    // https://arxiv.org/abs/1603.02720
+
+    std::size_t N = layers.size();
+    // vP[i] and vS[i] at the top of the layer i, vP[N] and vS[N] at the exit
+    std::vector<Column2> vP(N + 1), vS(N + 1);
+    // depth of the bottom of every layer
+    std::vector<double> bottoms(N);
+
+    complex nSinThetaSquared = (1.0 - incidentCosTheta * incidentCosTheta) *
+                               (nIncident * nIncident);
+    complex exitCosTheta = std::sqrt(1.0 - nSinThetaSquared / (nExit * nExit));
+
+    vP[N] = Column2(exitCosTheta, nExit);
+    vS[N] = Column2(1.0, nExit * exitCosTheta);
+
+    double depth = 0.0;
+    for (std::size_t i = 0; i < N; ++i) {
+        depth += layers[i].thickness;
+        bottoms[i] = depth;
+    }
+
+    for (std::size_t i = N; i-- > 0;) {
+        Matrix22 CP, CS;
+        layer_matrices_PS(layers[i].refractiveIndex, nSinThetaSquared,
+                          2.0 * M_PI * layers[i].thickness, &CP, &CS);
+        vP[i] = vP[i + 1];
+        vP[i].left_multiply_layer(CP.m11, CP.m12, CP.m21);
+        vS[i] = vS[i + 1];
+        vS[i].left_multiply_layer(CS.m11, CS.m12, CS.m21);
+    }
+
+    // amplitudes of the transmitted waves, t = 1 / m11
+    Matrix22 AP, AS;
+    incident_matrices_PS(incidentCosTheta, nIncident, &AP, &AS);
+    complex tP = 1.0 / (AP.m11 * vP[0].m11 + AP.m12 * vP[0].m21);
+    complex tS = 1.0 / (AS.m11 * vS[0].m11 + AS.m12 * vS[0].m21);
+
+    // incident powers, see power_coefficients_PS
+    double incidentP = std::real(nIncident * std::conj(incidentCosTheta));
+    double incidentS = std::real(nIncident * incidentCosTheta);
+
+    if (profileP.layerAbsorptance || profileS.layerAbsorptance) {
+        // the power through an interface is Re(E conj(H))
+        double fluxP = std::real(vP[0].m11 * std::conj(vP[0].m21)) * std::norm(tP) / incidentP;
+        double fluxS = std::real(vS[0].m11 * std::conj(vS[0].m21)) * std::norm(tS) / incidentS;
+        for (std::size_t i = 0; i < N; ++i) {
+            double nextP = std::real(vP[i + 1].m11 * std::conj(vP[i + 1].m21)) * std::norm(tP) / incidentP;
+            double nextS = std::real(vS[i + 1].m11 * std::conj(vS[i + 1].m21)) * std::norm(tS) / incidentS;
+            if (profileP.layerAbsorptance) {
+                profileP.layerAbsorptance[i] = fluxP - nextP;
+            }
+            if (profileS.layerAbsorptance) {
+                profileS.layerAbsorptance[i] = fluxS - nextS;
+            }
+            fluxP = nextP;
+            fluxS = nextS;
+        }
+    }
+
+    if (!profileP.intensity && !profileP.absorption && !profileS.intensity && !profileS.absorption) {
+        return;
+    }
+
+    for (std::size_t k = 0; k < depthCount; ++k) {
+        double z = depths[k];
+
+        // the field at the bottom of the layer holding z, propagated up to z
+        complex n;
+        double bottom;
+        std::size_t below;
+        if (z < 0.0) {
+            n = nIncident;
+            bottom = 0.0;
+            below = 0;
+        } else {
+            std::size_t i = std::upper_bound(bottoms.begin(), bottoms.end(), z) - bottoms.begin();
+            if (i == N) {
+                n = nExit;
+                bottom = N > 0 ? bottoms[N - 1] : 0.0;
+            } else {
+                n = layers[i].refractiveIndex;
+                bottom = bottoms[i];
+            }
+            below = i + (i < N ? 1 : 0);
+        }
+
+        Matrix22 CP, CS;
+        layer_matrices_PS(n, nSinThetaSquared, 2.0 * M_PI * (bottom - z), &CP, &CS);
+        Column2 wP = vP[below];
+        wP.left_multiply_layer(CP.m11, CP.m12, CP.m21);
+        Column2 wS = vS[below];
+        wS.left_multiply_layer(CS.m11, CS.m12, CS.m21);
+
+        // P: |E|^2 = |E_t|^2 + |nSinTheta H / n^2|^2, S: E is tangential
+        double n2 = std::norm(n);
+        double intensityP = (std::norm(wP.m11) + std::abs(nSinThetaSquared) * std::norm(wP.m21) / (n2 * n2)) *
+                            std::norm(tP);
+        double intensityS = std::norm(wS.m11) * std::norm(tS);
+
+        // absorbed power density k0 Im(n^2) |E|^2
+        double absorption = 2.0 * M_PI * std::imag(n * n);
+        if (profileP.intensity) {
+            profileP.intensity[k] = intensityP;
+        }
+        if (profileS.intensity) {
+            profileS.intensity[k] = intensityS;
+        }
+        if (profileP.absorption) {
+            profileP.absorption[k] = absorption * intensityP / incidentP;
+        }
+        if (profileS.absorption) {
+            profileS.absorption[k] = absorption * intensityS / incidentS;
+        }
+    }
+}
+
+}
+#endif
@@ -0,0 +1,141 @@
+#ifndef THINFILM_FIXED_H
+#define THINFILM_FIXED_H
+
+#include "thinfilm.hh"
+#include <array>
+
+// Stacks of a number of layers known at compile time
+//
+// A FixedStack<N> is a std::array of layers. Its evaluation is unrolled at
+// compile time, the layers are visited by a recursion on the index instead of
+// a loop, so a 2 to 8 layer coating is a straight sequence of complex
+// operations kept in registers. The terms of the incident and exit media
+// (angles, first columns of B and the row of A_0, transmittance factors) are
+// computed once in a MediumTerms, which many stacks on the same media and
+// angle share.
+
+namespace thinfilm {
+
+template <std::size_t N, class T = double>
+using FixedStack = std::array<BasicLayer<T>, N>;
+
+// Everything that only depends on the media and the incidence angle
+template <class T>
+struct BasicMediumTerms {
+    typedef std::complex<T> complex_type;
+
+    // nIncident * incidentSinTheta MUST be real
+    BasicMediumTerms(complex_type incidentCosTheta, complex_type nIncident, complex_type nExit)
+        : incidentCosTheta(incidentCosTheta), nIncident(nIncident), nExit(nExit) {
+        nSinThetaSquared = (T(1) - incidentCosTheta * incidentCosTheta) * (nIncident * nIncident);
+        exitCosTheta = std::sqrt(T(1) - nSinThetaSquared / (nExit * nExit));
+        exitP = BasicColumn2<T>(exitCosTheta, nExit);
+        exitS = BasicColumn2<T>(T(1), nExit * exitCosTheta);
+        incidentAdmittanceS = nIncident * incidentCosTheta;
+        scale = T(2) * incidentAdmittanceS;
+        factorP = std::real(nExit * std::conj(exitCosTheta)) / std::real(nIncident * std::conj(incidentCosTheta));
+        factorS = std::real(nExit * exitCosTheta) / std::real(incidentAdmittanceS);
+    }
+
+    complex_type incidentCosTheta;
+    complex_type nIncident;
+    complex_type nExit;
+
+    complex_type nSinThetaSquared;
+    complex_type exitCosTheta;
+    // first columns of B_p and B_s
+    BasicColumn2<T> exitP;
+    BasicColumn2<T> exitS;
+    // nIncident incidentCosTheta and 2 nIncident incidentCosTheta, of A_0
+    complex_type incidentAdmittanceS;
+    complex_type scale;
+    // |t|^2 to the transmittances
+    T factorP;
+    T factorS;
+};
+
+typedef BasicMediumTerms<double> MediumTerms;
+
+namespace detail {
+
+// Multiply the columns by the layers I - 1, I - 2, ..., 0
+template <std::size_t I>
+struct FixedLayers {
+    template <class T, std::size_t N>
+    static void left_multiply(const std::array<BasicLayer<T>, N> &layers, std::complex<T> nSinThetaSquared,
+                              BasicColumn2<T> *vP, BasicColumn2<T> *vS) {
+        typedef std::complex<T> C;
+        const BasicLayer<T> &layer = layers[I - 1];
+
+        C n = layer.refractiveIndex;
+        C cosTheta = std::sqrt(T(1) - nSinThetaSquared / (n * n));
+
+        C deltaLayer = T(2.0 * M_PI) * n * layer.thickness * cosTheta;
+        C c, s;
+        sincos(deltaLayer, &c, &s);
+        C js = C(0, -1) * s;
+
+        vP->left_multiply_layer(c, js * cosTheta / n, js * n / cosTheta);
+        vS->left_multiply_layer(c, js / cosTheta / n, js * n * cosTheta);
+
+        FixedLayers<I - 1>::left_multiply(layers, nSinThetaSquared, vP, vS);
+    }
+};
+
+template <>
+struct FixedLayers<0> {
+    template <class T, std::size_t N>
+    static void left_multiply(const std::array<BasicLayer<T>, N> &, std::complex<T>,
+                              BasicColumn2<T> *, BasicColumn2<T> *) {
+    }
+};
+
+}
+
+// Same as reflectance_transmittance, with the medium terms computed once
+template <class T, std::size_t N>
+void reflectance_transmittance(const BasicMediumTerms<T> &media, const std::array<BasicLayer<T>, N> &layers,
+                               T *reflectanceP, T *reflectanceS, T *transmittanceP, T *transmittanceS) {
+    typedef std::complex<T> C;
+    THINFILM_COUNT(Evaluations, 1);
+    THINFILM_COUNT(LayerEvaluations, N);
+
+    BasicColumn2<T> vP = media.exitP;
+    BasicColumn2<T> vS = media.exitS;
+    detail::FixedLayers<N>::left_multiply(layers, media.nSinThetaSquared, &vP, &vS);
+
+    // left multiply by A_0p and A_0s
+    C m11P = (media.nIncident * vP.m11 + media.incidentCosTheta * vP.m21) / media.scale;
+    C m21P = (media.nIncident * vP.m11 - media.incidentCosTheta * vP.m21) / media.scale;
+    C m11S = (media.incidentAdmittanceS * vS.m11 + vS.m21) / media.scale;
+    C m21S = (media.incidentAdmittanceS * vS.m11 - vS.m21) / media.scale;
+
+    *reflectanceP = std::norm(m21P / m11P);
+    *reflectanceS = std::norm(m21S / m11S);
+    *transmittanceP = std::norm(T(1) / m11P) * media.factorP;
+    *transmittanceS = std::norm(T(1) / m11S) * media.factorS;
+}
+
+// Same as reflectance, with the medium terms computed once
+template <class T, std::size_t N>
+void reflectance(const BasicMediumTerms<T> &media, const std::array<BasicLayer<T>, N> &layers,
+                 T *reflectanceP, T *reflectanceS) {
+    typedef std::complex<T> C;
+    THINFILM_COUNT(Evaluations, 1);
+    THINFILM_COUNT(LayerEvaluations, N);
+
+    BasicColumn2<T> vP = media.exitP;
+    BasicColumn2<T> vS = media.exitS;
+    detail::FixedLayers<N>::left_multiply(layers, media.nSinThetaSquared, &vP, &vS);
+
+    C m11P = media.nIncident * vP.m11 + media.incidentCosTheta * vP.m21;
+    C m21P = media.nIncident * vP.m11 - media.incidentCosTheta * vP.m21;
+    C m11S = media.incidentAdmittanceS * vS.m11 + vS.m21;
+    C m21S = media.incidentAdmittanceS * vS.m11 - vS.m21;
+
+    *reflectanceP = std::norm(m21P / m11P);
+    *reflectanceS = std::norm(m21S / m11S);
+}
+
+}
+#endif
@@ -0,0 +1,429 @@
+#ifndef THINFILM_GPU_H
+#define THINFILM_GPU_H
+
+#include "thinfilm.hh"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__HIPCC__)
+#include <hip/hip_runtime.h>
+#define THINFILM_GPU(name) hip##name
+#else
+#include <cuda_runtime.h>
+#define THINFILM_GPU(name) cuda##name
+#endif
+
+// GPU backend of batch_reflectance_transmittance, compiled by nvcc (CUDA) or
+// hipcc (HIP) in the translation unit that includes this header
+//
+//     nvcc -O3 -o program program.cu
+//     hipcc -O3 -o program program.cpp
+//
+// The stacks, the grid of wavelengths and angles and the optional dispersion
+// tables stay resident on the device, one evaluation only uploads the two
+// media. The stacks are evaluated in chunks on several streams: the results
+// of a chunk are copied back while the next chunks are computed. One thread
+// computes one (stack, wavelength, angle) as in transfer, with the first
+// column of the transfer matrix carried from the exit medium.
+
+namespace thinfilm {
+
+typedef THINFILM_GPU(Stream_t) GpuStream;
+typedef THINFILM_GPU(Error_t) GpuError;
+
+// Material of a layer taking the index of its stack
+const std::uint32_t gpuNoMaterial = 0xFFFFFFFFu;
+
+// Complex arithmetic of the kernels, the same on CUDA and HIP
+struct GpuComplex {
+    double re;
+    double im;
+};
+
+__device__ inline GpuComplex gpu_complex(double re, double im) {
+    GpuComplex a = { re, im };
+    return a;
+}
+
+__device__ inline GpuComplex operator+(GpuComplex a, GpuComplex b) {
+    return gpu_complex(a.re + b.re, a.im + b.im);
+}
+
+__device__ inline GpuComplex operator-(GpuComplex a, GpuComplex b) {
+    return gpu_complex(a.re - b.re, a.im - b.im);
+}
+
+__device__ inline GpuComplex operator*(GpuComplex a, GpuComplex b) {
+    return gpu_complex(fma(a.re, b.re, -a.im * b.im), fma(a.re, b.im, a.im * b.re));
+}
+
+__device__ inline GpuComplex operator*(double a, GpuComplex b) {
+    return gpu_complex(a * b.re, a * b.im);
+}
+
+__device__ inline double gpu_norm(GpuComplex a) {
+    return fma(a.re, a.re, a.im * a.im);
+}
+
+__device__ inline GpuComplex gpu_inverse(GpuComplex a) {
+    double scale = 1.0 / gpu_norm(a);
+    return gpu_complex(a.re * scale, -a.im * scale);
+}
+
+__device__ inline GpuComplex operator/(GpuComplex a, GpuComplex b) {
+    return a * gpu_inverse(b);
+}
+
+// Principal square root with the branch cut of std::sqrt
+__device__ inline GpuComplex gpu_sqrt(GpuComplex a) {
+    double r = hypot(a.re, a.im);
+    double t = sqrt(0.5 * (fabs(a.re) + r));
+    double u = fabs(a.im) / (t + t);
+    if (a.re < 0.0) {
+        return gpu_complex(u, copysign(t, a.im));
+    }
+    return gpu_complex(t, copysign(u, a.im));
+}
+
+// cos(z) and sin(z) together, see the scalar sincos
+__device__ inline void gpu_sincos(GpuComplex z, GpuComplex *c, GpuComplex *s) {
+    double sinX, cosX;
+    // the device sincos, not thinfilm::sincos
+    ::sincos(z.re, &sinX, &cosX);
+    double coshY = cosh(z.im);
+    double sinhY = sinh(z.im);
+    *c = gpu_complex(cosX * coshY, -sinX * sinhY);
+    *s = gpu_complex(sinX * coshY, cosX * sinhY);
+}
+
+// Device arrays of a batch
+struct GpuProblem {
+    GpuComplex nIncident;
+    GpuComplex nExit;
+
+    const std::size_t *offsets;
+    const double *thicknesses;
+    const GpuComplex *refractiveIndices;
+    // material of every layer, gpuNoMaterial for the index of the stack,
+    // with the tables [material * wavelengthCount + k]
+    const std::uint32_t *layerMaterials;
+    const GpuComplex *materialIndices;
+
+    const double *wavelengths;
+    std::size_t wavelengthCount;
+    const GpuComplex *incidentCosTheta;
+    std::size_t angleCount;
+};
+
+// One thread per result of the stacks first ... first + count - 1, the
+// outputs are relative to the first stack
+static __global__ void batch_reflectance_transmittance_kernel(GpuProblem p, std::size_t first,
+                                                              std::size_t count,
+                                                              double *reflectanceP, double *reflectanceS,
+                                                              double *transmittanceP, double *transmittanceS) {
+    std::size_t perStack = p.wavelengthCount * p.angleCount;
+    std::size_t total = count * perStack;
+
+    for (std::size_t out = blockIdx.x * std::size_t(blockDim.x) + threadIdx.x; out < total;
+         out += std::size_t(gridDim.x) * blockDim.x) {
+        std::size_t s = first + out / perStack;
+        std::size_t k = out % perStack / p.angleCount;
+        std::size_t a = out % p.angleCount;
+
+        GpuComplex cosI = p.incidentCosTheta[a];
+        GpuComplex nI = p.nIncident;
+        GpuComplex nE = p.nExit;
+        GpuComplex one = gpu_complex(1.0, 0.0);
+        double waveNumber = 2.0 * M_PI / p.wavelengths[k];
+
+        GpuComplex nSinThetaSquared = (one - cosI * cosI) * (nI * nI);
+        GpuComplex exitCosTheta = gpu_sqrt(one - nSinThetaSquared / (nE * nE));
+
+        // first columns of B_p and B_s
+        GpuComplex p11 = exitCosTheta, p21 = nE;
+        GpuComplex s11 = one, s21 = nE * exitCosTheta;
+
+        for (std::size_t i = p.offsets[s + 1]; i-- > p.offsets[s];) {
+            std::uint32_t m = p.layerMaterials ? p.layerMaterials[i] : gpuNoMaterial;
+            GpuComplex n = m == gpuNoMaterial ? p.refractiveIndices[i]
+                                            : p.materialIndices[m * p.wavelengthCount + k];
+            GpuComplex inverseN = gpu_inverse(n);
+            GpuComplex cosTheta = gpu_sqrt(one - nSinThetaSquared * (inverseN * inverseN));
+            GpuComplex inverseCosTheta = gpu_inverse(cosTheta);
+
+            GpuComplex c, sn;
+            gpu_sincos((waveNumber * p.thicknesses[i]) * (n * cosTheta), &c, &sn);
+            // -i s
+            GpuComplex js = gpu_complex(sn.im, -sn.re);
+
+            GpuComplex x12 = js * cosTheta * inverseN;
+            GpuComplex x21 = js * n * inverseCosTheta;
+            GpuComplex x = c * p11 + x12 * p21;
+            p21 = x21 * p11 + c * p21;
+            p11 = x;
+
+            x12 = js * inverseCosTheta * inverseN;
+            x21 = js * n * cosTheta;
+            x = c * s11 + x12 * s21;
+            s21 = x21 * s11 + c * s21;
+            s11 = x;
+        }
+
+        // left multiply by A_0p and A_0s, the common factor cancels in r and
+        // is kept for t
+        GpuComplex scale = gpu_inverse(2.0 * (nI * cosI));
+        GpuComplex m11P = (nI * p11 + cosI * p21) * scale;
+        GpuComplex m21P = (nI * p11 - cosI * p21) * scale;
+        GpuComplex m11S = (nI * cosI * s11 + s21) * scale;
+        GpuComplex m21S = (nI * cosI * s11 - s21) * scale;
+
+        GpuComplex conjExitCos = gpu_complex(exitCosTheta.re, -exitCosTheta.im);
+        GpuComplex conjCosI = gpu_complex(cosI.re, -cosI.im);
+        GpuComplex nECos = nE * exitCosTheta;
+        GpuComplex nICos = nI * cosI;
+
+        reflectanceP[out] = gpu_norm(m21P / m11P);
+        reflectanceS[out] = gpu_norm(m21S / m11S);
+        transmittanceP[out] = gpu_norm(gpu_inverse(m11P)) * (nE * conjExitCos).re / (nI * conjCosI).re;
+        transmittanceS[out] = gpu_norm(gpu_inverse(m11S)) * nECos.re / nICos.re;
+    }
+}
+
+// Page locked host memory, the copies to and from it are asynchronous
+// The outputs of GpuBatchEvaluator::reflectance_transmittance should live in
+// such buffers for the copies to overlap the computation.
+template <class T>
+class GpuHostBuffer {
+public:
+    explicit GpuHostBuffer(std::size_t size) : data_(0), size_(size) {
+#if defined(__HIPCC__)
+        hipHostMalloc(reinterpret_cast<void **>(&data_), size * sizeof(T), hipHostMallocDefault);
+#else
+        cudaMallocHost(reinterpret_cast<void **>(&data_), size * sizeof(T));
+#endif
+    }
+
+    ~GpuHostBuffer() {
+        if (data_) {
+#if defined(__HIPCC__)
+            hipHostFree(data_);
+#else
+            cudaFreeHost(data_);
+#endif
+        }
+    }
+
+    T *data() {
+        return data_;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    // null if the allocation failed
+    operator bool() const {
+        return data_ != 0;
+    }
+
+private:
+    GpuHostBuffer(const GpuHostBuffer &);
+    GpuHostBuffer &operator=(const GpuHostBuffer &);
+
+    T *data_;
+    std::size_t size_;
+};
+
+// Batch of stacks resident on the device, evaluated on a shared grid of
+// wavelengths and incidence angles
+//
+// Same layout and same results as batch_reflectance_transmittance: the result
+// of (stack s, wavelengths[k], incidentCosTheta[a]) is at
+// (s * wavelengthCount + k) * angleCount + a. The errors of the runtime are kept
+// in error(), the methods return false once an error occurred.
+class GpuBatchEvaluator {
+public:
+    // stacksPerChunk stacks are computed and copied back together, on
+    // streamCount streams (at least 1 of each)
+    GpuBatchEvaluator(const StackArena &stacks,
+                      const double *wavelengths, std::size_t wavelengthCount,
+                      const complex *incidentCosTheta, std::size_t angleCount,
+                      std::size_t stacksPerChunk = 4096, std::size_t streamCount = 3)
+        : error_(THINFILM_GPU(Success)), stackCount_(0), layerCount_(0),
+          wavelengthCount_(wavelengthCount), angleCount_(angleCount),
+          stacksPerChunk_(std::max<std::size_t>(stacksPerChunk, 1)),
+          streams_(std::max<std::size_t>(streamCount, 1)), outputs_(streams_.size()),
+          offsets_(0), thicknesses_(0), refractiveIndices_(0), layerMaterials_(0),
+          materialIndices_(0), wavelengths_(0), incidentCosTheta_(0) {
+        for (std::size_t c = 0; c < streams_.size(); ++c) {
+            check(THINFILM_GPU(StreamCreate)(&streams_[c]));
+            outputs_[c] = 0;
+            check(THINFILM_GPU(Malloc)(reinterpret_cast<void **>(&outputs_[c]),
+                                       4 * chunk_outputs() * sizeof(double)));
+        }
+        upload(&wavelengths_, wavelengths, wavelengthCount);
+        upload(&incidentCosTheta_, reinterpret_cast<const GpuComplex *>(incidentCosTheta), angleCount);
+        set_stacks(stacks);
+    }
+
+    ~GpuBatchEvaluator() {
+        for (std::size_t c = 0; c < streams_.size(); ++c) {
+            THINFILM_GPU(StreamSynchronize)(streams_[c]);
+            THINFILM_GPU(Free)(outputs_[c]);
+            THINFILM_GPU(StreamDestroy)(streams_[c]);
+        }
+        THINFILM_GPU(Free)(offsets_);
+        THINFILM_GPU(Free)(thicknesses_);
+        THINFILM_GPU(Free)(refractiveIndices_);
+        THINFILM_GPU(Free)(layerMaterials_);
+        THINFILM_GPU(Free)(materialIndices_);
+        THINFILM_GPU(Free)(wavelengths_);
+        THINFILM_GPU(Free)(incidentCosTheta_);
+    }
+
+    // Replace the stacks, the grid and the materials are kept
+    // The materials of the layers are reset to gpuNoMaterial.
+    bool set_stacks(const StackArena &stacks) {
+        stackCount_ = stacks.size();
+        layerCount_ = stacks.layer_count();
+        upload(&offsets_, stacks.offsets().data(), stacks.offsets().size());
+        upload(&thicknesses_, stacks.thicknesses().data(), layerCount_);
+        upload(&refractiveIndices_,
+               reinterpret_cast<const GpuComplex *>(stacks.refractiveIndices().data()), layerCount_);
+        THINFILM_GPU(Free)(layerMaterials_);
+        layerMaterials_ = 0;
+        return error_ == THINFILM_GPU(Success);
+    }
+
+    // Dispersive layers: the index of the layer i of the arena at the
+    // wavelength k is indices[layerMaterials[i] * wavelengthCount + k], or the
+    // index of the arena if layerMaterials[i] == gpuNoMaterial
+    // The tables are typically Material::refractive_indices on the grid.
+    bool set_materials(const complex *indices, std::size_t materialCount,
+                       const std::uint32_t *layerMaterials) {
+        upload(&materialIndices_, reinterpret_cast<const GpuComplex *>(indices),
+               materialCount * wavelengthCount_);
+        upload(&layerMaterials_, layerMaterials, layerCount_);
+        return error_ == THINFILM_GPU(Success);
+    }
+
+    // Evaluate all the stacks, the outputs hold
+    // stacks.size() * wavelengthCount * angleCount values
+    // nIncident * incidentSinTheta MUST be real
+    bool reflectance_transmittance(complex nIncident, complex nExit,
+                                   double *reflectanceP, double *reflectanceS,
+                                   double *transmittanceP, double *transmittanceS) {
+        if (error_ != THINFILM_GPU(Success)) {
+            return false;
+        }
+
+        GpuProblem p;
+        p.nIncident.re = nIncident.real();
+        p.nIncident.im = nIncident.imag();
+        p.nExit.re = nExit.real();
+        p.nExit.im = nExit.imag();
+        p.offsets = offsets_;
+        p.thicknesses = thicknesses_;
+        p.refractiveIndices = refractiveIndices_;
+        p.layerMaterials = layerMaterials_;
+        p.materialIndices = materialIndices_;
+        p.wavelengths = wavelengths_;
+        p.wavelengthCount = wavelengthCount_;
+        p.incidentCosTheta = incidentCosTheta_;
+        p.angleCount = angleCount_;
+
+        const unsigned blockSize = 256;
+        std::size_t perStack = wavelengthCount_ * angleCount_;
+        for (std::size_t first = 0, c = 0; first < stackCount_; first += stacksPerChunk_, ++c) {
+            // the stream of a chunk reuses its output buffer once the copies of
+            // its previous chunk are done, in stream order
+            GpuStream stream = streams_[c % streams_.size()];
+            double *output = outputs_[c % streams_.size()];
+            std::size_t count = std::min(stacksPerChunk_, stackCount_ - first);
+            std::size_t n = count * perStack;
+            if (n == 0) {
+                continue;
+            }
+            std::size_t chunk = chunk_outputs();
+
+            unsigned blocks = unsigned(std::min<std::size_t>((n + blockSize - 1) / blockSize, 65535));
+            batch_reflectance_transmittance_kernel<<<blocks, blockSize, 0, stream>>>(
+                p, first, count, output, output + chunk, output + 2 * chunk, output + 3 * chunk);
+            check(THINFILM_GPU(GetLastError)());
+
+            std::size_t out = first * perStack;
+            copy_back(reflectanceP + out, output, n, stream);
+            copy_back(reflectanceS + out, output + chunk, n, stream);
+            copy_back(transmittanceP + out, output + 2 * chunk, n, stream);
+            copy_back(transmittanceS + out, output + 3 * chunk, n, stream);
+        }
+
+        for (std::size_t c = 0; c < streams_.size(); ++c) {
+            check(THINFILM_GPU(StreamSynchronize)(streams_[c]));
+        }
+        return error_ == THINFILM_GPU(Success);
+    }
+
+    // The first error of the runtime
+    GpuError error() const {
+        return error_;
+    }
+
+    const char *error_string() const {
+        return THINFILM_GPU(GetErrorString)(error_);
+    }
+
+private:
+    GpuBatchEvaluator(const GpuBatchEvaluator &);
+    GpuBatchEvaluator &operator=(const GpuBatchEvaluator &);
+
+    std::size_t chunk_outputs() const {
+        return stacksPerChunk_ * wavelengthCount_ * angleCount_;
+    }
+
+    void check(GpuError error) {
+        if (error_ == THINFILM_GPU(Success)) {
+            error_ = error;
+        }
+    }
+
+    // Replace the device array *device by a copy of the host array
+    template <class T>
+    void upload(T **device, const T *host, std::size_t count) {
+        THINFILM_GPU(Free)(*device);
+        *device = 0;
+        if (count == 0) {
+            return;
+        }
+        check(THINFILM_GPU(Malloc)(reinterpret_cast<void **>(device), count * sizeof(T)));
+        check(THINFILM_GPU(Memcpy)(*device, host, count * sizeof(T),
+                                   THINFILM_GPU(MemcpyHostToDevice)));
+    }
+
+    void copy_back(double *host, const double *device, std::size_t count, GpuStream stream) {
+        check(THINFILM_GPU(MemcpyAsync)(host, device, count * sizeof(double),
+                                        THINFILM_GPU(MemcpyDeviceToHost), stream));
+    }
+
+    GpuError error_;
+    std::size_t stackCount_;
+    std::size_t layerCount_;
+    std::size_t wavelengthCount_;
+    std::size_t angleCount_;
+    std::size_t stacksPerChunk_;
+
+    std::vector<GpuStream> streams_;
+    // 4 planes of chunk_outputs() results per stream
+    std::vector<double *> outputs_;
+
+    std::size_t *offsets_;
+    double *thicknesses_;
+    GpuComplex *refractiveIndices_;
+    std::uint32_t *layerMaterials_;
+    GpuComplex *materialIndices_;
+    double *wavelengths_;
+    GpuComplex *incidentCosTheta_;
+};
+
+}
+#endif
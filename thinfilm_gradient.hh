@@ -0,0 +1,208 @@
+#ifndef THINFILM_GRADIENT_H
+#define THINFILM_GRADIENT_H
+
+#include "thinfilm.hh"
+
+// Analytic derivatives of the power coefficients with respect to the layer
+// parameters
+//
+// With M = A C_1 ... C_N B, the derivative with respect to a parameter of the
+// layer i is A C_1 ... C_i-1 (dC_i) C_i+1 ... C_N B. One backward pass stores
+// the first columns of the suffix products, one forward pass accumulates the
+// prefix products, the gradient of the whole stack costs O(N).
+
+namespace thinfilm {
+
+// Derivatives of a power coefficient, arrays of one value per layer
+// A null array is not computed
+struct LayerDerivatives {
+    LayerDerivatives()
+        : thickness(0), n(0), k(0) {
+    }
+    LayerDerivatives(double *thickness, double *n = 0, double *k = 0)
+        : thickness(thickness), n(n), k(k) {
+    }
+
+    // d / d thickness, the thickness in the unit of the stack
+    double *thickness;
+    // d / d real(refractiveIndex)
+    double *n;
+    // d / d imag(refractiveIndex)
+    double *k;
+};
+
+// Layer matrix ( c    x12 ) and its derivatives with respect to the
+//              ( x21  c   )
+// thickness and to the (complex) refractive index
+struct LayerMatrixDerivatives {
+    complex c, x12, x21;
+    complex dc_dd, dx12_dd, dx21_dd;
+    complex dc_dn, dx12_dn, dx21_dn;
+};
+
+// Derivatives of the first column (m11, m21) of M
+struct ColumnDerivatives {
+    complex dm11_dd, dm21_dd;
+    complex dm11_dn, dm21_dn;
+};
+
+// d (L C w) for L a 2x2 matrix and w a column
+inline void column_derivatives(const Matrix22 &L, const LayerMatrixDerivatives &C, const Column2 &w,
+                               ColumnDerivatives *d) {
+    complex a = C.dc_dd * w.m11 + C.dx12_dd * w.m21;
+    complex b = C.dx21_dd * w.m11 + C.dc_dd * w.m21;
+    d->dm11_dd = L.m11 * a + L.m12 * b;
+    d->dm21_dd = L.m21 * a + L.m22 * b;
+
+    a = C.dc_dn * w.m11 + C.dx12_dn * w.m21;
+    b = C.dx21_dn * w.m11 + C.dc_dn * w.m21;
+    d->dm11_dn = L.m11 * a + L.m12 * b;
+    d->dm21_dn = L.m21 * a + L.m22 * b;
+}
+
+// Store the derivatives of |r|^2 and factor * |t|^2 of the layer i
+// r = m21 / m11 and t = 1 / m11
+inline void power_derivatives(complex m11, complex m21, double factor, const ColumnDerivatives &d,
+                              std::size_t i,
+                              const LayerDerivatives &dReflectance, const LayerDerivatives &dTransmittance) {
+    complex r = m21 / m11;
+    complex t = 1.0 / m11;
+
+    complex dr_dd = (d.dm21_dd - r * d.dm11_dd) * t;
+    complex dr_dn = (d.dm21_dn - r * d.dm11_dn) * t;
+    complex dt_dd = -t * t * d.dm11_dd;
+    complex dt_dn = -t * t * d.dm11_dn;
+
+    // d|z|^2 = 2 Re(conj(z) dz), d/dk = i d/dn for an holomorphic function of n + ik
+    if (dReflectance.thickness) {
+        dReflectance.thickness[i] = 2.0 * std::real(std::conj(r) * dr_dd);
+    }
+    if (dReflectance.n) {
+        dReflectance.n[i] = 2.0 * std::real(std::conj(r) * dr_dn);
+    }
+    if (dReflectance.k) {
+        dReflectance.k[i] = -2.0 * std::imag(std::conj(r) * dr_dn);
+    }
+
+    if (dTransmittance.thickness) {
+        dTransmittance.thickness[i] = factor * 2.0 * std::real(std::conj(t) * dt_dd);
+    }
+    if (dTransmittance.n) {
+        dTransmittance.n[i] = factor * 2.0 * std::real(std::conj(t) * dt_dn);
+    }
+    if (dTransmittance.k) {
+        dTransmittance.k[i] = -factor * 2.0 * std::imag(std::conj(t) * dt_dn);
+    }
+}
+
+// Reflectance and transmittance together with their derivatives with respect
+// to the thickness, the index and the extinction coefficient of every layer
+//
+// The derivative arrays hold layers.size() values, see LayerDerivatives
+template <class Stack>
+void reflectance_transmittance_gradient(complex incidentCosTheta, complex nIncident, complex nExit,
+                                        const Stack &layers,
+                                        double *reflectanceP, double *reflectanceS,
+                                        double *transmittanceP, double *transmittanceS,
+                                        const LayerDerivatives &dReflectanceP,
+                                        const LayerDerivatives &dReflectanceS,
+                                        const LayerDerivatives &dTransmittanceP,
+                                        const LayerDerivatives &dTransmittanceS) {
+    // nIncident * incidentSinTheta MUST be real, see
+    // https://arxiv.org/abs/1603.02720
+
+    struct LayerState {
+        LayerMatrixDerivatives P;
+        LayerMatrixDerivatives S;
+        // first columns of C_i+1 ... C_N B
+        Column2 vP;
+        Column2 vS;
+    };
+
+    std::size_t N = layers.size();
+    std::vector<LayerState> states(N);
+
+    complex nSinThetaSquared = (1.0 - incidentCosTheta * incidentCosTheta) *
+                               (nIncident * nIncident);
+    complex exitCosTheta = std::sqrt(1.0 - nSinThetaSquared / (nExit * nExit));
+
+    Column2 vP(exitCosTheta, nExit);
+    Column2 vS(1.0, nExit * exitCosTheta);
+
+    const complex j(0.0, 1.0);
+    for (std::size_t i = N; i-- > 0;) {
+        LayerState &state = states[i];
+        state.vP = vP;
+        state.vS = vS;
+
+        complex n = layers[i].refractiveIndex;
+        double d = layers[i].thickness;
+        complex cosTheta = std::sqrt(1.0 - nSinThetaSquared / (n * n));
+        // u = n cosTheta, du/dn = 1 / cosTheta
+        complex u = n * cosTheta;
+
+        complex deltaLayer = 2.0 * M_PI * d * u;
+        complex c, s;
+        sincos(deltaLayer, &c, &s);
+        complex ddelta_dd = 2.0 * M_PI * u;
+        complex ddelta_dn = 2.0 * M_PI * d / cosTheta;
+
+        // P: x12 = -i s u / n^2, x21 = -i s n^2 / u
+        // S: x12 = -i s / u,     x21 = -i s u
+        state.P.c = state.S.c = c;
+        state.P.x12 = -j * s * cosTheta / n;
+        state.P.x21 = -j * s * n / cosTheta;
+        state.S.x12 = -j * s / cosTheta / n;
+        state.S.x21 = -j * s * n * cosTheta;
+
+        state.P.dc_dd = state.S.dc_dd = -s * ddelta_dd;
+        state.P.dx12_dd = -j * c * ddelta_dd * cosTheta / n;
+        state.P.dx21_dd = -j * c * ddelta_dd * n / cosTheta;
+        state.S.dx12_dd = -j * c * ddelta_dd / cosTheta / n;
+        state.S.dx21_dd = -j * c * ddelta_dd * n * cosTheta;
+
+        state.P.dc_dn = state.S.dc_dn = -s * ddelta_dn;
+        state.P.dx12_dn = -j * (c * ddelta_dn * u / (n * n) + s / (u * n) - 2.0 * s * u / (n * n * n));
+        state.P.dx21_dn = -j * (c * ddelta_dn * n * n / u + s * (2.0 * n / u - n * n * n / (u * u * u)));
+        state.S.dx12_dn = -j * (c * ddelta_dn / u - s * n / (u * u * u));
+        state.S.dx21_dn = -j * (c * ddelta_dn * u + s * n / u);
+
+        vP.left_multiply_layer(state.P.c, state.P.x12, state.P.x21);
+        vS.left_multiply_layer(state.S.c, state.S.x12, state.S.x21);
+    }
+
+    Matrix22 LP, LS;
+    incident_matrices_PS(incidentCosTheta, nIncident, &LP, &LS);
+
+    complex m11P = LP.m11 * vP.m11 + LP.m12 * vP.m21;
+    complex m21P = LP.m21 * vP.m11 + LP.m22 * vP.m21;
+    complex m11S = LS.m11 * vS.m11 + LS.m12 * vS.m21;
+    complex m21S = LS.m21 * vS.m11 + LS.m22 * vS.m21;
+
+    double factorP = std::real(nExit * std::conj(exitCosTheta)) /
+                     std::real(nIncident * std::conj(incidentCosTheta));
+    double factorS = std::real(nExit * exitCosTheta) /
+                     std::real(nIncident * incidentCosTheta);
+
+    *reflectanceP = std::norm(m21P / m11P);
+    *reflectanceS = std::norm(m21S / m11S);
+    *transmittanceP = std::norm(1.0 / m11P) * factorP;
+    *transmittanceS = std::norm(1.0 / m11S) * factorS;
+
+    for (std::size_t i = 0; i < N; ++i) {
+        const LayerState &state = states[i];
+        ColumnDerivatives d;
+
+        column_derivatives(LP, state.P, state.vP, &d);
+        power_derivatives(m11P, m21P, factorP, d, i, dReflectanceP, dTransmittanceP);
+
+        column_derivatives(LS, state.S, state.vS, &d);
+        power_derivatives(m11S, m21S, factorS, d, i, dReflectanceS, dTransmittanceS);
+
+        LP *= Matrix22(state.P.c, state.P.x12, state.P.x21, state.P.c);
+        LS *= Matrix22(state.S.c, state.S.x12, state.S.x21, state.S.c);
+    }
+}
+
+}
+#endif
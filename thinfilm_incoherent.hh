@@ -0,0 +1,149 @@
+#ifndef THINFILM_INCOHERENT_H
+#define THINFILM_INCOHERENT_H
+
+#include "thinfilm.hh"
+#include <algorithm>
+#include <limits>
+
+// Stacks with incoherent layers, e.g. a thin film coating on a 1 mm substrate
+//
+// The coherent layers between two incoherent layers (or the outer media) form
+// a coherent group, its power coefficients R and T from both sides give the
+// intensity transfer matrix
+//
+//          1   | 1     -Rb           |
+//    L = ----  |                     |
+//         Tf   | Rf    Tf Tb - Rf Rb |
+//
+// and an incoherent layer propagates the intensities with
+//
+//        | 1/a  0 |
+//    P = |        |      with a = |exp(i 2pi n d / lambda_0 cos(th))|^2
+//        | 0    a |
+//
+// The product M = L_0 P_1 L_1 ... L_K gives R = M21 / M11 and T = 1 / M11,
+// the incoherent result in one evaluation, without averaging over phases.
+
+namespace thinfilm {
+
+// Layers begin ... end - 1 of a stack, optionally in reverse order
+template <class Stack>
+struct StackRange {
+    StackRange(const Stack &layers, std::size_t begin, std::size_t end, bool reversed)
+        : layers(&layers), begin(begin), end(end), reversed(reversed) {
+    }
+
+    std::size_t size() const {
+        return end - begin;
+    }
+
+    Layer operator[](std::size_t i) const {
+        return (*layers)[reversed ? end - 1 - i : begin + i];
+    }
+
+    const Stack *layers;
+    std::size_t begin;
+    std::size_t end;
+    bool reversed;
+};
+
+// Real 2x2 matrix of intensities, kept as scale * M with the scale in log so
+// that thick absorbing layers or opaque groups do not overflow
+struct IntensityMatrix {
+    IntensityMatrix()
+        : m11(1.0), m12(0.0), m21(0.0), m22(1.0), logScale(0.0) {
+    }
+
+    // *this = *this * (1/f) ( a11  a12 )
+    //                       ( a21  a22 )
+    void multiply(double a11, double a12, double a21, double a22, double f) {
+        double x11 = m11 * a11 + m12 * a21;
+        double x12 = m11 * a12 + m12 * a22;
+        double x21 = m21 * a11 + m22 * a21;
+        double x22 = m21 * a12 + m22 * a22;
+        m11 = x11;
+        m12 = x12;
+        m21 = x21;
+        m22 = x22;
+        logScale -= std::log(f);
+
+        // renormalize, the ratios R and T do not depend on it
+        double norm = std::max(std::max(std::fabs(m11), std::fabs(m12)),
+                               std::max(std::fabs(m21), std::fabs(m22)));
+        if (norm > 0.0 && norm < std::numeric_limits<double>::infinity()) {
+            m11 /= norm;
+            m12 /= norm;
+            m21 /= norm;
+            m22 /= norm;
+            logScale += std::log(norm);
+        }
+    }
+
+    double m11, m12, m21, m22;
+    double logScale;
+};
+
+// Reflectance and transmittance of a stack where the layers i with
+// incoherent[i] true are incoherent
+//
+// incoherent is indexable by the layer, e.g. a bool array or a
+// std::vector<bool>. The coherent layers behave as in reflectance_transmittance,
+// with no incoherent layer the result is the same.
+// nIncident * incidentSinTheta MUST be real
+template <class Stack, class Flags>
+void incoherent_reflectance_transmittance(complex incidentCosTheta, complex nIncident,
+                                          complex nExit, const Stack &layers,
+                                          const Flags &incoherent,
+                                          double *reflectanceP, double *reflectanceS,
+                                          double *transmittanceP, double *transmittanceS) {
+    complex nSinThetaSquared = (1.0 - incidentCosTheta * incidentCosTheta) *
+                               (nIncident * nIncident);
+
+    IntensityMatrix MP, MS;
+
+    // medium before the current coherent group
+    complex nA = nIncident;
+    complex cosA = incidentCosTheta;
+    std::size_t begin = 0;
+
+    for (std::size_t i = 0; i <= layers.size(); ++i) {
+        if (i < layers.size() && !incoherent[i]) {
+            continue;
+        }
+
+        // medium after the group, the incoherent layer i or the exit medium
+        complex nB = i < layers.size() ? layers[i].refractiveIndex : nExit;
+        complex cosB = std::sqrt(1.0 - nSinThetaSquared / (nB * nB));
+
+        double RfP, RfS, TfP, TfS;
+        double RbP, RbS, TbP, TbS;
+        reflectance_transmittance(cosA, nA, nB, StackRange<Stack>(layers, begin, i, false),
+                                  &RfP, &RfS, &TfP, &TfS);
+        reflectance_transmittance(cosB, nB, nA, StackRange<Stack>(layers, begin, i, true),
+                                  &RbP, &RbS, &TbP, &TbS);
+
+        MP.multiply(1.0, -RbP, RfP, TfP * TbP - RfP * RbP, TfP);
+        MS.multiply(1.0, -RbS, RfS, TfS * TbS - RfS * RbS, TfS);
+
+        if (i < layers.size()) {
+            // a = exp(-2 Im(delta)), P = (1 / a) diag(1, a^2)
+            double imDelta = std::imag(2.0 * M_PI * layers[i].thickness * nB * cosB);
+            double a2 = std::exp(-4.0 * imDelta);
+            double a = std::exp(-2.0 * imDelta);
+            MP.multiply(1.0, 0.0, 0.0, a2, a);
+            MS.multiply(1.0, 0.0, 0.0, a2, a);
+        }
+
+        nA = nB;
+        cosA = cosB;
+        begin = i + 1;
+    }
+
+    *reflectanceP = MP.m21 / MP.m11;
+    *reflectanceS = MS.m21 / MS.m11;
+    *transmittanceP = std::exp(-MP.logScale) / MP.m11;
+    *transmittanceS = std::exp(-MS.logScale) / MS.m11;
+}
+
+}
+#endif
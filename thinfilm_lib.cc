@@ -0,0 +1,14 @@
+// Compiled part of the library, the stack entry points for std::vector<Layer>
+// and StackView
+//
+//     g++ -O2 -c thinfilm_lib.cc && ar rcs libthinfilm.a thinfilm_lib.o
+//
+// and compile the users with -DTHINFILM_EXTERN_TEMPLATES, see thinfilm.hh
+#include "thinfilm.hh"
+
+namespace thinfilm {
+
+THINFILM_INSTANTIATE(template, std::vector<Layer>)
+THINFILM_INSTANTIATE(template, StackView)
+
+}
@@ -0,0 +1,330 @@
+#ifndef THINFILM_MATERIAL_H
+#define THINFILM_MATERIAL_H
+
+#include "thinfilm.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// Dispersive materials and spectral sweeps of stacks made of them
+//
+// A material is shared by many stacks through a std::shared_ptr. It caches its
+// refractive indices on the wavelength grids it is evaluated on, so a sweep of
+// many stacks made of few materials evaluates every dispersion formula once per
+// material and per wavelength, whatever the number of stacks and layers.
+// The wavelengths are in the unit chosen by the caller, the coefficients of
+// the models are in the same unit.
+
+namespace thinfilm {
+
+// Wavelengths of a sweep, with an identity for the caches of the materials
+//
+// The values cannot change: a copy shares the identity, a new grid gets a new
+// one.
+class WavelengthGrid {
+public:
+    WavelengthGrid(const double *wavelengths, std::size_t count)
+        : wavelengths_(wavelengths, wavelengths + count), id_(next_id()) {
+    }
+    explicit WavelengthGrid(const std::vector<double> &wavelengths)
+        : wavelengths_(wavelengths), id_(next_id()) {
+    }
+
+    std::size_t size() const {
+        return wavelengths_.size();
+    }
+
+    double operator[](std::size_t k) const {
+        return wavelengths_[k];
+    }
+
+    const double *data() const {
+        return wavelengths_.data();
+    }
+
+    std::uint64_t id() const {
+        return id_;
+    }
+
+private:
+    static std::uint64_t next_id() {
+        static std::atomic<std::uint64_t> counter(0);
+        return ++counter;
+    }
+
+    std::vector<double> wavelengths_;
+    std::uint64_t id_;
+};
+
+// Refractive index as a function of the wavelength, n + ik with k non-negative
+class Material {
+public:
+    Material() {
+    }
+    virtual ~Material() {
+    }
+
+    virtual complex refractive_index(double wavelength) const = 0;
+
+    // Refractive indices at the wavelengths of the grid
+    //
+    // Computed on the first call for a grid and cached, the few last grids are
+    // kept. Thread safe, the table stays valid as long as it is held.
+    std::shared_ptr<const std::vector<complex> > refractive_indices(const WavelengthGrid &grid) const {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::size_t c = 0; c < cache_.size(); ++c) {
+                if (cache_[c].first == grid.id()) {
+                    THINFILM_COUNT(MaterialCacheHits, 1);
+                    return cache_[c].second;
+                }
+            }
+        }
+
+        // evaluated out of the lock, a concurrent miss computes the same table
+        THINFILM_COUNT(MaterialCacheMisses, 1);
+        std::shared_ptr<std::vector<complex> > table(new std::vector<complex>(grid.size()));
+        for (std::size_t k = 0; k < grid.size(); ++k) {
+            (*table)[k] = refractive_index(grid[k]);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (cache_.size() == cacheSize) {
+            cache_.erase(cache_.begin());
+        }
+        cache_.push_back(std::make_pair(grid.id(), std::shared_ptr<const std::vector<complex> >(table)));
+        return cache_.back().second;
+    }
+
+private:
+    Material(const Material &);
+    Material &operator=(const Material &);
+
+    static const std::size_t cacheSize = 4;
+
+    mutable std::mutex mutex_;
+    // (grid id, table), the oldest first
+    mutable std::vector<std::pair<std::uint64_t, std::shared_ptr<const std::vector<complex> > > > cache_;
+};
+
+// Same index at every wavelength
+class ConstantMaterial : public Material {
+public:
+    explicit ConstantMaterial(complex refractiveIndex) : refractiveIndex_(refractiveIndex) {
+    }
+
+    complex refractive_index(double) const {
+        return refractiveIndex_;
+    }
+
+private:
+    complex refractiveIndex_;
+};
+
+// n^2 = 1 + sum B_j lambda^2 / (lambda^2 - C_j)
+// C_j in the unit of the wavelength squared
+class SellmeierMaterial : public Material {
+public:
+    SellmeierMaterial() {
+    }
+
+    // Add the term B lambda^2 / (lambda^2 - C)
+    void add_term(double B, double C) {
+        B_.push_back(B);
+        C_.push_back(C);
+    }
+
+    complex refractive_index(double wavelength) const {
+        double lambda2 = wavelength * wavelength;
+        double n2 = 1.0;
+        for (std::size_t j = 0; j < B_.size(); ++j) {
+            n2 += B_[j] * lambda2 / (lambda2 - C_[j]);
+        }
+        return std::sqrt(complex(n2));
+    }
+
+private:
+    std::vector<double> B_;
+    std::vector<double> C_;
+};
+
+// n = A + B / lambda^2 + C / lambda^4, k constant
+class CauchyMaterial : public Material {
+public:
+    CauchyMaterial(double A, double B, double C = 0.0, double k = 0.0)
+        : A_(A), B_(B), C_(C), k_(k) {
+    }
+
+    complex refractive_index(double wavelength) const {
+        double inverseLambda2 = 1.0 / (wavelength * wavelength);
+        return complex(A_ + (B_ + C_ * inverseLambda2) * inverseLambda2, k_);
+    }
+
+private:
+    double A_, B_, C_, k_;
+};
+
+// Dielectric function with Drude and Lorentz terms of the photon energy E
+//
+//     eps = epsInfinity - sum Ep^2 / (E^2 + i gamma E)
+//                       + sum f E0^2 / (E0^2 - E^2 - i gamma E)
+//
+// with E = energyScale / lambda. The default energyScale is hc in eV nm, for
+// energies in eV and wavelengths in nm.
+class DrudeLorentzMaterial : public Material {
+public:
+    explicit DrudeLorentzMaterial(double epsInfinity, double energyScale = 1239.8419843320026)
+        : epsInfinity_(epsInfinity), energyScale_(energyScale) {
+    }
+
+    // Free carriers with plasma energy Ep and damping gamma
+    void add_drude(double plasmaEnergy, double damping) {
+        Term term = { 0.0, plasmaEnergy, damping, true };
+        terms_.push_back(term);
+    }
+
+    // Oscillator of strength f at the energy E0 with width gamma
+    void add_lorentz(double strength, double resonanceEnergy, double width) {
+        Term term = { strength, resonanceEnergy, width, false };
+        terms_.push_back(term);
+    }
+
+    complex refractive_index(double wavelength) const {
+        const complex j(0.0, 1.0);
+        double E = energyScale_ / wavelength;
+        complex eps = epsInfinity_;
+        for (std::size_t t = 0; t < terms_.size(); ++t) {
+            const Term &term = terms_[t];
+            double E02 = term.energy * term.energy;
+            if (term.drude) {
+                eps -= E02 / (E * E + j * term.gamma * E);
+            } else {
+                eps += term.strength * E02 / (E02 - E * E - j * term.gamma * E);
+            }
+        }
+        // Im(eps) >= 0, the principal root has a non-negative k
+        return std::sqrt(eps);
+    }
+
+private:
+    struct Term {
+        double strength;
+        double energy;
+        double gamma;
+        bool drude;
+    };
+
+    double epsInfinity_;
+    double energyScale_;
+    std::vector<Term> terms_;
+};
+
+// Measured indices, linearly interpolated between the wavelengths of the table
+// and constant beyond its ends
+class TabulatedMaterial : public Material {
+public:
+    // wavelengths in increasing order
+    TabulatedMaterial(const double *wavelengths, const complex *refractiveIndices, std::size_t count)
+        : wavelengths_(wavelengths, wavelengths + count),
+          refractiveIndices_(refractiveIndices, refractiveIndices + count) {
+    }
+
+    complex refractive_index(double wavelength) const {
+        std::size_t k = std::upper_bound(wavelengths_.begin(), wavelengths_.end(), wavelength) -
+                        wavelengths_.begin();
+        if (k == 0) {
+            return refractiveIndices_.front();
+        }
+        if (k == wavelengths_.size()) {
+            return refractiveIndices_.back();
+        }
+        double x = (wavelength - wavelengths_[k - 1]) / (wavelengths_[k] - wavelengths_[k - 1]);
+        return refractiveIndices_[k - 1] + x * (refractiveIndices_[k] - refractiveIndices_[k - 1]);
+    }
+
+private:
+    std::vector<double> wavelengths_;
+    std::vector<complex> refractiveIndices_;
+};
+
+// Stack of layers of a physical thickness made of shared materials
+class MaterialStack {
+public:
+    // thickness in the unit of the wavelengths
+    void add(double thickness, const std::shared_ptr<const Material> &material) {
+        thicknesses_.push_back(thickness);
+        materials_.push_back(material);
+    }
+
+    std::size_t size() const {
+        return thicknesses_.size();
+    }
+
+    double thickness(std::size_t i) const {
+        return thicknesses_[i];
+    }
+
+    const Material &material(std::size_t i) const {
+        return *materials_[i];
+    }
+
+private:
+    std::vector<double> thicknesses_;
+    std::vector<std::shared_ptr<const Material> > materials_;
+};
+
+// Same as spectral_reflectance_transmittance for a stack of materials
+//
+// The indices are taken from the caches of the materials, a layer costs only
+// its matrix products. The outputs are arrays of wavelengths.size() values.
+// nIncident * incidentSinTheta MUST be real
+inline void spectral_reflectance_transmittance(complex incidentCosTheta,
+                                               const Material &incident, const Material &exit,
+                                               const MaterialStack &layers,
+                                               const WavelengthGrid &wavelengths,
+                                               double *reflectanceP, double *reflectanceS,
+                                               double *transmittanceP, double *transmittanceS) {
+    typedef std::shared_ptr<const std::vector<complex> > Table;
+
+    std::size_t layerCount = layers.size();
+    std::vector<Table> tables(layerCount);
+    for (std::size_t i = 0; i < layerCount; ++i) {
+        // consecutive layers of the same material share the lookup
+        if (i > 0 && &layers.material(i) == &layers.material(i - 1)) {
+            tables[i] = tables[i - 1];
+        } else {
+            tables[i] = layers.material(i).refractive_indices(wavelengths);
+        }
+    }
+    Table nIncident = incident.refractive_indices(wavelengths);
+    Table nExit = exit.refractive_indices(wavelengths);
+
+    complex incidentSinThetaSquared = 1.0 - incidentCosTheta * incidentCosTheta;
+
+    for (std::size_t k = 0; k < wavelengths.size(); ++k) {
+        complex nI = (*nIncident)[k];
+        complex nE = (*nExit)[k];
+
+        Matrix22 MatP, MatS;
+        incident_matrices_PS(incidentCosTheta, nI, &MatP, &MatS);
+
+        complex nSinThetaSquared = incidentSinThetaSquared * (nI * nI);
+        double waveNumber = 2.0 * M_PI / wavelengths[k];
+
+        for (std::size_t i = 0; i < layerCount; ++i) {
+            multiply_layer_PS((*tables[i])[k], nSinThetaSquared, waveNumber * layers.thickness(i),
+                              &MatP, &MatS);
+        }
+
+        complex exitCosTheta = multiply_exit_PS(nSinThetaSquared, nE, &MatP, &MatS);
+
+        power_coefficients_PS(MatP, MatS, incidentCosTheta, nI, exitCosTheta, nE,
+                              reflectanceP + k, reflectanceS + k,
+                              transmittanceP + k, transmittanceS + k);
+    }
+}
+
+}
+#endif
@@ -0,0 +1,195 @@
+#ifndef THINFILM_PERIODIC_H
+#define THINFILM_PERIODIC_H
+
+#include "thinfilm.hh"
+#include <cassert>
+
+namespace thinfilm {
+
+// a^k by squaring, O(log k) products
+inline Matrix22 power(Matrix22 a, std::size_t k) {
+    Matrix22 x(1.0, 0.0, 0.0, 1.0);
+    while (k > 0) {
+        if (k & 1) {
+            x *= a;
+        }
+        k >>= 1;
+        if (k > 0) {
+            // not a *= a, operator*= reads b while writing
+            a = a * a;
+        }
+    }
+    return x;
+}
+
+// Stack described with repeated groups, e.g. (HL)^k or H (LH)^5 ((HL)^3 LL)^20
+//
+// The description is kept as written: a repeated group is evaluated once and
+// its matrices are raised to the power of the repetition count, so the cost
+// and the memory grow with log(k) and not with the expanded stack.
+//
+//     PeriodicStack mirror;
+//     mirror.begin_repeat();
+//     mirror.add(H);
+//     mirror.add(L);
+//     mirror.end_repeat(500);
+class PeriodicStack {
+public:
+    PeriodicStack() : depth_(0) {
+    }
+
+    void add(const Layer &layer) {
+        Item item = { Item::LAYER, layer, 0 };
+        items_.push_back(item);
+    }
+
+    template <class Stack>
+    void add_layers(const Stack &layers) {
+        for (std::size_t i = 0; i < layers.size(); ++i) {
+            add(layers[i]);
+        }
+    }
+
+    // Open a group, the groups can be nested
+    void begin_repeat() {
+        Item item = { Item::BEGIN, Layer(), 0 };
+        items_.push_back(item);
+        ++depth_;
+    }
+
+    // Close the last opened group, it is repeated count times
+    void end_repeat(std::size_t count) {
+        assert(depth_ > 0);
+        Item item = { Item::END, Layer(), count };
+        items_.push_back(item);
+        --depth_;
+    }
+
+    // Number of layers of the expanded stack
+    std::size_t layer_count() const {
+        std::vector<std::size_t> counts(1, 0);
+        for (std::size_t i = 0; i < items_.size(); ++i) {
+            if (items_[i].kind == Item::LAYER) {
+                ++counts.back();
+            } else if (items_[i].kind == Item::BEGIN) {
+                counts.push_back(0);
+            } else {
+                std::size_t group = counts.back() * items_[i].count;
+                counts.pop_back();
+                counts.back() += group;
+            }
+        }
+        return counts[0];
+    }
+
+    // The expanded stack, for the tools that need the flat list of layers
+    std::vector<Layer> expand() const {
+        std::vector<std::vector<Layer> > groups(1);
+        for (std::size_t i = 0; i < items_.size(); ++i) {
+            if (items_[i].kind == Item::LAYER) {
+                groups.back().push_back(items_[i].layer);
+            } else if (items_[i].kind == Item::BEGIN) {
+                groups.push_back(std::vector<Layer>());
+            } else {
+                std::vector<Layer> group;
+                group.swap(groups.back());
+                groups.pop_back();
+                for (std::size_t k = 0; k < items_[i].count; ++k) {
+                    groups.back().insert(groups.back().end(), group.begin(), group.end());
+                }
+            }
+        }
+        return groups[0];
+    }
+
+    // Product of the layer matrices C_p and C_s of the whole stack
+    // nSinThetaSquared = (nIncident * incidentSinTheta)^2
+    void layer_product_PS(complex nSinThetaSquared, Matrix22 *productP, Matrix22 *productS) const {
+        assert(depth_ == 0);
+        const Matrix22 identity(1.0, 0.0, 0.0, 1.0);
+
+        // product of the current group of every open level
+        std::vector<std::pair<Matrix22, Matrix22> > products(1, std::make_pair(identity, identity));
+        for (std::size_t i = 0; i < items_.size(); ++i) {
+            const Item &item = items_[i];
+            if (item.kind == Item::LAYER) {
+                multiply_layer_PS(item.layer.refractiveIndex, nSinThetaSquared,
+                                  2.0 * M_PI * item.layer.thickness,
+                                  &products.back().first, &products.back().second);
+            } else if (item.kind == Item::BEGIN) {
+                products.push_back(std::make_pair(identity, identity));
+            } else {
+                std::pair<Matrix22, Matrix22> group = products.back();
+                products.pop_back();
+                products.back().first *= power(group.first, item.count);
+                products.back().second *= power(group.second, item.count);
+            }
+        }
+        *productP = products[0].first;
+        *productS = products[0].second;
+    }
+
+private:
+    struct Item {
+        enum Kind { LAYER, BEGIN, END };
+
+        Kind kind;
+        Layer layer;
+        // repetitions of the group closed by an END
+        std::size_t count;
+    };
+
+    std::vector<Item> items_;
+    std::size_t depth_;
+};
+
+inline std::pair<Matrix22, Matrix22> transfer_matrix_PS(complex incidentCosTheta, complex nIncident,
+                                                        complex nExit, const PeriodicStack &layers) {
+    // nIncident * incidentSinTheta MUST be real, see
+    // https://arxiv.org/abs/1603.02720
+
+    Matrix22 MatP, MatS;
+    incident_matrices_PS(incidentCosTheta, nIncident, &MatP, &MatS);
+
+    complex nSinThetaSquared = (1.0 - incidentCosTheta * incidentCosTheta) *
+                               (nIncident * nIncident);
+
+    Matrix22 productP, productS;
+    layers.layer_product_PS(nSinThetaSquared, &productP, &productS);
+    MatP *= productP;
+    MatS *= productS;
+
+    multiply_exit_PS(nSinThetaSquared, nExit, &MatP, &MatS);
+
+    return std::pair<Matrix22, Matrix22>(MatP, MatS);
+}
+
+inline void reflectance_transmittance(complex incidentCosTheta, complex nIncident,
+                                      complex nExit, const PeriodicStack &layers,
+                                      double *reflectanceP, double *reflectanceS,
+                                      double *transmittanceP, double *transmittanceS) {
+
+    std::pair<Matrix22, Matrix22> matricies = transfer_matrix_PS(incidentCosTheta, nIncident, nExit, layers);
+
+    complex exitCosTheta =
+        std::sqrt(1.0 -
+                  (1.0 - incidentCosTheta * incidentCosTheta) *
+                  (nIncident * nIncident) / (nExit * nExit));
+
+    power_coefficients_PS(matricies.first, matricies.second, incidentCosTheta, nIncident,
+                          exitCosTheta, nExit,
+                          reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+}
+
+inline void reflectance(complex incidentCosTheta, complex nIncident, complex nExit,
+                        const PeriodicStack &layers, double *reflectanceP,
+                        double *reflectanceS) {
+
+    std::pair<Matrix22, Matrix22> matricies = transfer_matrix_PS(incidentCosTheta, nIncident, nExit, layers);
+
+    *reflectanceP = std::norm(matricies.first.m21 / matricies.first.m11);
+    *reflectanceS = std::norm(matricies.second.m21 / matricies.second.m11);
+}
+
+}
+#endif
@@ -0,0 +1,93 @@
+/*
+   C interface of the sweeps for thinfilm.py
+
+   g++ -O2 -shared -fPIC -pthread -o libthinfilm_python.so thinfilm_python.cc
+
+   thinfilm.py loads the library with ctypes, which releases the GIL for the
+   duration of every call. The arrays are the buffers of the NumPy arrays,
+   nothing is copied: a complex array is an array of (real, imaginary) double
+   pairs, the layout of std::complex<double> and of numpy.complex128. The
+   complex scalars are passed as two doubles.
+ */
+#include "thinfilm.hh"
+#include "thinfilm_batch.hh"
+#include "thinfilm_simd.hh"
+
+using namespace thinfilm;
+
+namespace {
+
+const complex *complex_array(const double *a) {
+    return reinterpret_cast<const complex *>(a);
+}
+
+// Shared by the calls, WorkStealingPool serializes the loops
+WorkStealingPool &pool() {
+    static WorkStealingPool pool;
+    return pool;
+}
+
+}
+
+extern "C" {
+
+const char *thinfilm_simd_path() {
+    return simd_path_name(simd_kernels().path);
+}
+
+std::size_t thinfilm_thread_count() {
+    return pool().size();
+}
+
+// spectral_reflectance_transmittance_simd, the thicknesses in the unit of the
+// wavelengths and refractiveIndices[i * wavelengthCount + k]
+void thinfilm_spectral_reflectance_transmittance(double incidentCosThetaRe, double incidentCosThetaIm,
+                                                 const double *nIncident, const double *nExit,
+                                                 const double *thicknesses, std::size_t layerCount,
+                                                 const double *refractiveIndices,
+                                                 const double *wavelengths, std::size_t wavelengthCount,
+                                                 double *reflectanceP, double *reflectanceS,
+                                                 double *transmittanceP, double *transmittanceS) {
+    spectral_reflectance_transmittance_simd(complex(incidentCosThetaRe, incidentCosThetaIm),
+                                            complex_array(nIncident), complex_array(nExit),
+                                            thicknesses, layerCount, complex_array(refractiveIndices),
+                                            wavelengths, wavelengthCount,
+                                            reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+}
+
+// angular_reflectance_transmittance, the thicknesses in unit of the wavelength
+void thinfilm_angular_reflectance_transmittance(const double *incidentCosTheta, std::size_t angleCount,
+                                                double nIncidentRe, double nIncidentIm,
+                                                double nExitRe, double nExitIm,
+                                                const double *thicknesses,
+                                                const double *refractiveIndices,
+                                                std::size_t layerCount,
+                                                double *reflectanceP, double *reflectanceS,
+                                                double *transmittanceP, double *transmittanceS) {
+    angular_reflectance_transmittance(complex_array(incidentCosTheta), angleCount,
+                                      complex(nIncidentRe, nIncidentIm), complex(nExitRe, nExitIm),
+                                      StackView(thicknesses, complex_array(refractiveIndices), layerCount),
+                                      reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+}
+
+// batch_reflectance_transmittance on all the cores, the stacks packed as in a
+// StackArenaView
+void thinfilm_batch_reflectance_transmittance(double nIncidentRe, double nIncidentIm,
+                                              double nExitRe, double nExitIm,
+                                              const std::size_t *offsets, std::size_t stackCount,
+                                              const double *thicknesses,
+                                              const double *refractiveIndices,
+                                              const double *wavelengths, std::size_t wavelengthCount,
+                                              const double *incidentCosTheta, std::size_t angleCount,
+                                              double *reflectanceP, double *reflectanceS,
+                                              double *transmittanceP, double *transmittanceS) {
+    batch_reflectance_transmittance(pool(), complex(nIncidentRe, nIncidentIm),
+                                    complex(nExitRe, nExitIm),
+                                    StackArenaView(offsets, stackCount, thicknesses,
+                                                   complex_array(refractiveIndices)),
+                                    wavelengths, wavelengthCount,
+                                    complex_array(incidentCosTheta), angleCount,
+                                    reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+}
+
+}
@@ -0,0 +1,556 @@
+#ifndef THINFILM_SIMD_H
+#define THINFILM_SIMD_H
+
+#include "thinfilm.hh"
+#include <algorithm>
+#include <cmath>
+
+#include <cstdlib>
+#include <cstring>
+
+// Runtime dispatch: the AVX2 and AVX-512 packs are compiled with target
+// attributes whatever the compiler flags, and the sweeps take the best one the
+// CPU supports, chosen on the first call. THINFILM_DISPATCH=0 keeps only the
+// instruction set of the compiler flags.
+#ifndef THINFILM_DISPATCH
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define THINFILM_DISPATCH 1
+#else
+#define THINFILM_DISPATCH 0
+#endif
+#endif
+
+#if THINFILM_DISPATCH || (defined(__AVX2__) && defined(__FMA__))
+#define THINFILM_AVX2 1
+#endif
+#if THINFILM_DISPATCH || defined(__AVX512F__)
+#define THINFILM_AVX512 1
+#endif
+
+#if defined(THINFILM_AVX2) || defined(THINFILM_AVX512)
+#include <immintrin.h>
+#endif
+
+// Advanced SIMD is part of every AArch64 CPU, no dispatch is needed
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define THINFILM_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Functions defined between THINFILM_TARGET_PUSH(isa) and THINFILM_TARGET_POP
+// are compiled for the instruction set isa
+#define THINFILM_STRINGIFY(x) #x
+#if defined(__clang__)
+#define THINFILM_TARGET_PUSH(isa) \
+    _Pragma(THINFILM_STRINGIFY(clang attribute push(__attribute__((target(isa))), apply_to = function)))
+#define THINFILM_TARGET_POP _Pragma("clang attribute pop")
+#else
+// GCC 12 takes the _mm512_undefined_pd() operands of the intrinsics for
+// uninitialized variables
+#define THINFILM_TARGET_PUSH(isa)                                                  \
+    _Pragma("GCC push_options") _Pragma(THINFILM_STRINGIFY(GCC target(isa)))       \
+    _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wuninitialized\"")
+#define THINFILM_TARGET_POP _Pragma("GCC diagnostic pop") _Pragma("GCC pop_options")
+#endif
+
+// Structure of arrays evaluation of independent problems (wavelengths or
+// angles) going through the same layer loop. The real and imaginary parts of
+// the matrix elements of all the lanes are stored in separate planes so that
+// the products are done with plain packed double (or float) arithmetic.
+
+namespace thinfilm {
+
+#ifndef THINFILM_SIMD_LANES
+#define THINFILM_SIMD_LANES 8
+#endif
+
+// Lanes of the single precision sweeps, twice as many floats fit in a register
+#ifndef THINFILM_SIMD_FLOAT_LANES
+#define THINFILM_SIMD_FLOAT_LANES 16
+#endif
+
+// Packs of double and of float, the kernels are written once for all of them
+struct PackScalar {
+    enum { size = 1 };
+    typedef double scalar;
+    typedef double type;
+
+    static type load(const double *p) { return *p; }
+    static void store(double *p, type a) { *p = a; }
+    static type set1(double a) { return a; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    // a * b + c
+    static type fmadd(type a, type b, type c) { return a * b + c; }
+    // c - a * b
+    static type fnmadd(type a, type b, type c) { return c - a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    static type abs(type a) { return std::fabs(a); }
+    static type min(type a, type b) { return std::min(a, b); }
+    static type max(type a, type b) { return std::max(a, b); }
+    // magnitude of a with the sign of b
+    static type copysign(type a, type b) { return std::copysign(a, b); }
+    // to the nearest integer
+    static type round(type a) { return std::nearbyint(a); }
+    static type floor(type a) { return std::floor(a); }
+    // 2^n for an integer n in [-1022, 1023]
+    static type exp2i(type n) { return std::ldexp(1.0, int(n)); }
+
+    typedef bool mask;
+    static mask less(type a, type b) { return a < b; }
+    static mask equal(type a, type b) { return a == b; }
+    // m ? a : b
+    static type select(mask m, type a, type b) { return m ? a : b; }
+};
+
+#if defined(THINFILM_AVX2)
+THINFILM_TARGET_PUSH("avx2,fma")
+struct PackAVX2 {
+    enum { size = 4 };
+    typedef double scalar;
+    typedef __m256d type;
+
+    static type load(const double *p) { return _mm256_loadu_pd(p); }
+    static void store(double *p, type a) { _mm256_storeu_pd(p, a); }
+    static type set1(double a) { return _mm256_set1_pd(a); }
+    static type add(type a, type b) { return _mm256_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm256_fmadd_pd(a, b, c); }
+    static type fnmadd(type a, type b, type c) { return _mm256_fnmadd_pd(a, b, c); }
+    static type div(type a, type b) { return _mm256_div_pd(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_pd(a); }
+    static type abs(type a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+    static type min(type a, type b) { return _mm256_min_pd(a, b); }
+    static type max(type a, type b) { return _mm256_max_pd(a, b); }
+    static type copysign(type a, type b) {
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        return _mm256_or_pd(_mm256_andnot_pd(sign, a), _mm256_and_pd(sign, b));
+    }
+    static type round(type a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type floor(type a) { return _mm256_floor_pd(a); }
+    static type exp2i(type n) {
+        __m256i e = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n));
+        e = _mm256_slli_epi64(_mm256_add_epi64(e, _mm256_set1_epi64x(1023)), 52);
+        return _mm256_castsi256_pd(e);
+    }
+
+    typedef __m256d mask;
+    static mask less(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static mask equal(type a, type b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    static type select(mask m, type a, type b) { return _mm256_blendv_pd(b, a, m); }
+};
+THINFILM_TARGET_POP
+#endif
+
+#if defined(THINFILM_AVX512)
+THINFILM_TARGET_PUSH("avx512f")
+struct PackAVX512 {
+    enum { size = 8 };
+    typedef double scalar;
+    typedef __m512d type;
+
+    static type load(const double *p) { return _mm512_loadu_pd(p); }
+    static void store(double *p, type a) { _mm512_storeu_pd(p, a); }
+    static type set1(double a) { return _mm512_set1_pd(a); }
+    static type add(type a, type b) { return _mm512_add_pd(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_pd(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_pd(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm512_fmadd_pd(a, b, c); }
+    static type fnmadd(type a, type b, type c) { return _mm512_fnmadd_pd(a, b, c); }
+    static type div(type a, type b) { return _mm512_div_pd(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_pd(a); }
+    static type abs(type a) { return _mm512_abs_pd(a); }
+    static type min(type a, type b) { return _mm512_min_pd(a, b); }
+    static type max(type a, type b) { return _mm512_max_pd(a, b); }
+    static type copysign(type a, type b) {
+        const __m512i sign = _mm512_set1_epi64(0x8000000000000000ll);
+        return _mm512_castsi512_pd(_mm512_or_si512(_mm512_andnot_si512(sign, _mm512_castpd_si512(a)),
+                                                   _mm512_and_si512(sign, _mm512_castpd_si512(b))));
+    }
+    static type round(type a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type floor(type a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static type exp2i(type n) { return _mm512_scalef_pd(_mm512_set1_pd(1.0), n); }
+
+    typedef __mmask8 mask;
+    static mask less(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    static mask equal(type a, type b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+    static type select(mask m, type a, type b) { return _mm512_mask_blend_pd(m, b, a); }
+};
+THINFILM_TARGET_POP
+#endif
+
+#if defined(THINFILM_NEON)
+struct PackNEON {
+    enum { size = 2 };
+    typedef double scalar;
+    typedef float64x2_t type;
+
+    static type load(const double *p) { return vld1q_f64(p); }
+    static void store(double *p, type a) { vst1q_f64(p, a); }
+    static type set1(double a) { return vdupq_n_f64(a); }
+    static type add(type a, type b) { return vaddq_f64(a, b); }
+    static type sub(type a, type b) { return vsubq_f64(a, b); }
+    static type mul(type a, type b) { return vmulq_f64(a, b); }
+    static type fmadd(type a, type b, type c) { return vfmaq_f64(c, a, b); }
+    static type fnmadd(type a, type b, type c) { return vfmsq_f64(c, a, b); }
+    static type div(type a, type b) { return vdivq_f64(a, b); }
+    static type sqrt(type a) { return vsqrtq_f64(a); }
+    static type abs(type a) { return vabsq_f64(a); }
+    static type min(type a, type b) { return vminq_f64(a, b); }
+    static type max(type a, type b) { return vmaxq_f64(a, b); }
+    static type copysign(type a, type b) { return vbslq_f64(vdupq_n_u64(0x8000000000000000ull), b, a); }
+    static type round(type a) { return vrndnq_f64(a); }
+    static type floor(type a) { return vrndmq_f64(a); }
+    static type exp2i(type n) {
+        int64x2_t e = vaddq_s64(vcvtnq_s64_f64(n), vdupq_n_s64(1023));
+        return vreinterpretq_f64_s64(vshlq_n_s64(e, 52));
+    }
+
+    typedef uint64x2_t mask;
+    static mask less(type a, type b) { return vcltq_f64(a, b); }
+    static mask equal(type a, type b) { return vceqq_f64(a, b); }
+    static type select(mask m, type a, type b) { return vbslq_f64(m, a, b); }
+};
+#endif
+
+struct PackScalarFloat {
+    enum { size = 1 };
+    typedef float scalar;
+    typedef float type;
+
+    static type load(const float *p) { return *p; }
+    static void store(float *p, type a) { *p = a; }
+    static type set1(float a) { return a; }
+    static type add(type a, type b) { return a + b; }
+    static type sub(type a, type b) { return a - b; }
+    static type mul(type a, type b) { return a * b; }
+    static type fmadd(type a, type b, type c) { return a * b + c; }
+    static type fnmadd(type a, type b, type c) { return c - a * b; }
+    static type div(type a, type b) { return a / b; }
+    static type sqrt(type a) { return std::sqrt(a); }
+    static type abs(type a) { return std::fabs(a); }
+    static type min(type a, type b) { return std::min(a, b); }
+    static type max(type a, type b) { return std::max(a, b); }
+    static type copysign(type a, type b) { return std::copysign(a, b); }
+    static type round(type a) { return std::nearbyint(a); }
+    static type floor(type a) { return std::floor(a); }
+    // 2^n for an integer n in [-126, 127]
+    static type exp2i(type n) { return std::ldexp(1.0f, int(n)); }
+
+    typedef bool mask;
+    static mask less(type a, type b) { return a < b; }
+    static mask equal(type a, type b) { return a == b; }
+    static type select(mask m, type a, type b) { return m ? a : b; }
+};
+
+#if defined(THINFILM_AVX2)
+THINFILM_TARGET_PUSH("avx2,fma")
+struct PackAVX2Float {
+    enum { size = 8 };
+    typedef float scalar;
+    typedef __m256 type;
+
+    static type load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, type a) { _mm256_storeu_ps(p, a); }
+    static type set1(float a) { return _mm256_set1_ps(a); }
+    static type add(type a, type b) { return _mm256_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm256_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm256_mul_ps(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+    static type fnmadd(type a, type b, type c) { return _mm256_fnmadd_ps(a, b, c); }
+    static type div(type a, type b) { return _mm256_div_ps(a, b); }
+    static type sqrt(type a) { return _mm256_sqrt_ps(a); }
+    static type abs(type a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+    static type min(type a, type b) { return _mm256_min_ps(a, b); }
+    static type max(type a, type b) { return _mm256_max_ps(a, b); }
+    static type copysign(type a, type b) {
+        const __m256 sign = _mm256_set1_ps(-0.0f);
+        return _mm256_or_ps(_mm256_andnot_ps(sign, a), _mm256_and_ps(sign, b));
+    }
+    static type round(type a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type floor(type a) { return _mm256_floor_ps(a); }
+    static type exp2i(type n) {
+        __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+        return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+    }
+
+    typedef __m256 mask;
+    static mask less(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static mask equal(type a, type b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static type select(mask m, type a, type b) { return _mm256_blendv_ps(b, a, m); }
+};
+THINFILM_TARGET_POP
+#endif
+
+#if defined(THINFILM_AVX512)
+THINFILM_TARGET_PUSH("avx512f")
+struct PackAVX512Float {
+    enum { size = 16 };
+    typedef float scalar;
+    typedef __m512 type;
+
+    static type load(const float *p) { return _mm512_loadu_ps(p); }
+    static void store(float *p, type a) { _mm512_storeu_ps(p, a); }
+    static type set1(float a) { return _mm512_set1_ps(a); }
+    static type add(type a, type b) { return _mm512_add_ps(a, b); }
+    static type sub(type a, type b) { return _mm512_sub_ps(a, b); }
+    static type mul(type a, type b) { return _mm512_mul_ps(a, b); }
+    static type fmadd(type a, type b, type c) { return _mm512_fmadd_ps(a, b, c); }
+    static type fnmadd(type a, type b, type c) { return _mm512_fnmadd_ps(a, b, c); }
+    static type div(type a, type b) { return _mm512_div_ps(a, b); }
+    static type sqrt(type a) { return _mm512_sqrt_ps(a); }
+    static type abs(type a) { return _mm512_abs_ps(a); }
+    static type min(type a, type b) { return _mm512_min_ps(a, b); }
+    static type max(type a, type b) { return _mm512_max_ps(a, b); }
+    static type copysign(type a, type b) {
+        const __m512i sign = _mm512_set1_epi32(0x80000000);
+        return _mm512_castsi512_ps(_mm512_or_si512(_mm512_andnot_si512(sign, _mm512_castps_si512(a)),
+                                                   _mm512_and_si512(sign, _mm512_castps_si512(b))));
+    }
+    static type round(type a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static type floor(type a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static type exp2i(type n) { return _mm512_scalef_ps(_mm512_set1_ps(1.0f), n); }
+
+    typedef __mmask16 mask;
+    static mask less(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static mask equal(type a, type b) { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+    static type select(mask m, type a, type b) { return _mm512_mask_blend_ps(m, b, a); }
+};
+THINFILM_TARGET_POP
+#endif
+
+#if defined(THINFILM_NEON)
+struct PackNEONFloat {
+    enum { size = 4 };
+    typedef float scalar;
+    typedef float32x4_t type;
+
+    static type load(const float *p) { return vld1q_f32(p); }
+    static void store(float *p, type a) { vst1q_f32(p, a); }
+    static type set1(float a) { return vdupq_n_f32(a); }
+    static type add(type a, type b) { return vaddq_f32(a, b); }
+    static type sub(type a, type b) { return vsubq_f32(a, b); }
+    static type mul(type a, type b) { return vmulq_f32(a, b); }
+    static type fmadd(type a, type b, type c) { return vfmaq_f32(c, a, b); }
+    static type fnmadd(type a, type b, type c) { return vfmsq_f32(c, a, b); }
+    static type div(type a, type b) { return vdivq_f32(a, b); }
+    static type sqrt(type a) { return vsqrtq_f32(a); }
+    static type abs(type a) { return vabsq_f32(a); }
+    static type min(type a, type b) { return vminq_f32(a, b); }
+    static type max(type a, type b) { return vmaxq_f32(a, b); }
+    static type copysign(type a, type b) { return vbslq_f32(vdupq_n_u32(0x80000000u), b, a); }
+    static type round(type a) { return vrndnq_f32(a); }
+    static type floor(type a) { return vrndmq_f32(a); }
+    static type exp2i(type n) {
+        int32x4_t e = vaddq_s32(vcvtnq_s32_f32(n), vdupq_n_s32(127));
+        return vreinterpretq_f32_s32(vshlq_n_s32(e, 23));
+    }
+
+    typedef uint32x4_t mask;
+    static mask less(type a, type b) { return vcltq_f32(a, b); }
+    static mask equal(type a, type b) { return vceqq_f32(a, b); }
+    static type select(mask m, type a, type b) { return vbslq_f32(m, a, b); }
+};
+#endif
+
+#if defined(__AVX512F__)
+typedef PackAVX512 NativePack;
+typedef PackAVX512Float NativePackFloat;
+#elif defined(__AVX2__) && defined(__FMA__)
+typedef PackAVX2 NativePack;
+typedef PackAVX2Float NativePackFloat;
+#elif defined(THINFILM_NEON)
+typedef PackNEON NativePack;
+typedef PackNEONFloat NativePackFloat;
+#else
+typedef PackScalar NativePack;
+typedef PackScalarFloat NativePackFloat;
+#endif
+
+// Native pack of the scalar type T
+template <class T>
+struct NativePackOf;
+
+template <>
+struct NativePackOf<double> {
+    typedef NativePack type;
+};
+
+template <>
+struct NativePackOf<float> {
+    typedef NativePackFloat type;
+};
+
+#include "thinfilm_simd_kernels.hh"
+
+// Kernels of the dispatch, compiled for their instruction set
+#if THINFILM_DISPATCH
+THINFILM_TARGET_PUSH("avx2,fma")
+namespace avx2 {
+#include "thinfilm_simd_kernels.hh"
+}
+THINFILM_TARGET_POP
+
+THINFILM_TARGET_PUSH("avx512f")
+namespace avx512 {
+#include "thinfilm_simd_kernels.hh"
+}
+THINFILM_TARGET_POP
+#else
+namespace avx2 = ::thinfilm;
+namespace avx512 = ::thinfilm;
+#endif
+
+template <std::size_t Lanes, class T>
+Matrix22Batch<Lanes, T> &operator*=(Matrix22Batch<Lanes, T> &a, const Matrix22Batch<Lanes, T> &b) {
+    multiply<typename NativePackOf<T>::type>(&a, b);
+    return a;
+}
+
+// Instruction sets of the runtime dispatch
+enum class SimdPath { Scalar, NEON, AVX2, AVX512 };
+
+inline const char *simd_path_name(SimdPath path) {
+    switch (path) {
+    case SimdPath::NEON:
+        return "neon";
+    case SimdPath::AVX2:
+        return "avx2";
+    case SimdPath::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+typedef void (*SpectralSweep)(complex, const complex *, const complex *, const double *,
+                              std::size_t, const complex *, const double *, std::size_t,
+                              double *, double *, double *, double *);
+typedef void (*SpectralSweepFloat)(std::complex<float>, const std::complex<float> *,
+                                   const std::complex<float> *, const float *, std::size_t,
+                                   const std::complex<float> *, const float *, std::size_t,
+                                   float *, float *, float *, float *);
+
+// Kernels of an instruction set, the scalar ones if it is not compiled in
+struct SimdKernels {
+    SimdPath path;
+    SpectralSweep sweep;
+    SpectralSweepFloat sweepFloat;
+};
+
+inline SimdKernels simd_kernels(SimdPath path) {
+    SimdKernels kernels = { SimdPath::Scalar,
+                            spectral_sweep_simd<THINFILM_SIMD_LANES, double, PackScalar>,
+                            spectral_sweep_simd<THINFILM_SIMD_FLOAT_LANES, float, PackScalarFloat> };
+    (void)path; // unused when no pack is compiled in
+#if defined(THINFILM_NEON)
+    if (path == SimdPath::NEON) {
+        SimdKernels neon = { path,
+                             spectral_sweep_simd<THINFILM_SIMD_LANES, double, PackNEON>,
+                             spectral_sweep_simd<THINFILM_SIMD_FLOAT_LANES, float, PackNEONFloat> };
+        kernels = neon;
+    }
+#endif
+#if defined(THINFILM_AVX2)
+    if (path == SimdPath::AVX2) {
+        SimdKernels avx2 = { path,
+                             avx2::spectral_sweep_simd<THINFILM_SIMD_LANES, double, PackAVX2>,
+                             avx2::spectral_sweep_simd<THINFILM_SIMD_FLOAT_LANES, float, PackAVX2Float> };
+        kernels = avx2;
+    }
+#endif
+#if defined(THINFILM_AVX512)
+    if (path == SimdPath::AVX512) {
+        SimdKernels avx512 = { path,
+                               avx512::spectral_sweep_simd<THINFILM_SIMD_LANES, double, PackAVX512>,
+                               avx512::spectral_sweep_simd<THINFILM_SIMD_FLOAT_LANES, float,
+                                                           PackAVX512Float> };
+        kernels = avx512;
+    }
+#endif
+    return kernels;
+}
+
+// Best instruction set of the CPU, at most the one named by the environment
+// variable THINFILM_SIMD (scalar, neon, avx2 or avx512) if it is set
+inline SimdPath detect_simd_path() {
+    SimdPath path = SimdPath::Scalar;
+#if THINFILM_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        path = SimdPath::AVX512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        path = SimdPath::AVX2;
+    }
+#elif defined(__AVX512F__)
+    path = SimdPath::AVX512;
+#elif defined(__AVX2__) && defined(__FMA__)
+    path = SimdPath::AVX2;
+#elif defined(THINFILM_NEON)
+    path = SimdPath::NEON;
+#endif
+
+    const char *limit = std::getenv("THINFILM_SIMD");
+    if (limit != 0) {
+        for (int p = int(SimdPath::Scalar); p < int(path); ++p) {
+            // only the instruction sets compiled in
+            if (simd_kernels(SimdPath(p)).path == SimdPath(p) &&
+                std::strcmp(limit, simd_path_name(SimdPath(p))) == 0) {
+                path = SimdPath(p);
+            }
+        }
+    }
+    return path;
+}
+
+// Kernels of the sweeps, chosen on the first call. simd_kernels().path tells
+// which instruction set is used.
+inline const SimdKernels &simd_kernels() {
+    static const SimdKernels kernels = simd_kernels(detect_simd_path());
+    return kernels;
+}
+
+// Same as spectral_reflectance_transmittance, THINFILM_SIMD_LANES wavelengths
+// go through the layer loop together
+inline void spectral_reflectance_transmittance_simd(complex incidentCosTheta,
+                                                    const complex *nIncident, const complex *nExit,
+                                                    const double *thicknesses, std::size_t layerCount,
+                                                    const complex *refractiveIndices,
+                                                    const double *wavelengths, std::size_t wavelengthCount,
+                                                    double *reflectanceP, double *reflectanceS,
+                                                    double *transmittanceP, double *transmittanceS) {
+    THINFILM_COUNT(Sweeps, 1);
+    THINFILM_COUNT(Evaluations, wavelengthCount);
+    THINFILM_COUNT(LayerEvaluations, layerCount * wavelengthCount);
+    simd_kernels().sweep(incidentCosTheta, nIncident, nExit, thicknesses, layerCount,
+                         refractiveIndices, wavelengths, wavelengthCount,
+                         reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+}
+
+// Single precision sweep for screening, THINFILM_SIMD_FLOAT_LANES wavelengths
+// go through the layer loop together
+//
+// The results are accurate to about 1e-5 for stacks of moderate thickness.
+// The candidates kept by the screening are refined with the double precision
+// overload and the same arrays converted to double.
+inline void spectral_reflectance_transmittance_simd(std::complex<float> incidentCosTheta,
+                                                    const std::complex<float> *nIncident,
+                                                    const std::complex<float> *nExit,
+                                                    const float *thicknesses, std::size_t layerCount,
+                                                    const std::complex<float> *refractiveIndices,
+                                                    const float *wavelengths, std::size_t wavelengthCount,
+                                                    float *reflectanceP, float *reflectanceS,
+                                                    float *transmittanceP, float *transmittanceS) {
+    THINFILM_COUNT(Sweeps, 1);
+    THINFILM_COUNT(Evaluations, wavelengthCount);
+    THINFILM_COUNT(LayerEvaluations, layerCount * wavelengthCount);
+    simd_kernels().sweepFloat(incidentCosTheta, nIncident, nExit, thicknesses, layerCount,
+                              refractiveIndices, wavelengths, wavelengthCount,
+                              reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+}
+
+}
+#endif
@@ -0,0 +1,405 @@
+// Kernels of thinfilm_simd.hh, written once for all the packs
+//
+// No include guard: thinfilm_simd.hh includes this file in the namespace
+// thinfilm for the instruction set of the compiler flags and, with
+// THINFILM_DISPATCH, once more per instruction set in a namespace compiled
+// for it, so that the kernels of a pack are compiled with its instructions.
+
+// Complex numbers of a pack: one register for the real parts and one for the
+// imaginary parts
+template <class Pack>
+struct ComplexPack {
+    typename Pack::type re;
+    typename Pack::type im;
+
+    static ComplexPack load(const typename Pack::scalar *re, const typename Pack::scalar *im) {
+        ComplexPack a;
+        a.re = Pack::load(re);
+        a.im = Pack::load(im);
+        return a;
+    }
+
+    void store(typename Pack::scalar *re, typename Pack::scalar *im) const {
+        Pack::store(re, this->re);
+        Pack::store(im, this->im);
+    }
+};
+
+template <class Pack>
+ComplexPack<Pack> operator*(const ComplexPack<Pack> &a, const ComplexPack<Pack> &b) {
+    ComplexPack<Pack> x;
+    x.re = Pack::fnmadd(a.im, b.im, Pack::mul(a.re, b.re));
+    x.im = Pack::fmadd(a.im, b.re, Pack::mul(a.re, b.im));
+    return x;
+}
+
+// a * b + c
+template <class Pack>
+ComplexPack<Pack> fmadd(const ComplexPack<Pack> &a, const ComplexPack<Pack> &b,
+                        const ComplexPack<Pack> &c) {
+    ComplexPack<Pack> x;
+    x.re = Pack::fmadd(a.re, b.re, Pack::fnmadd(a.im, b.im, c.re));
+    x.im = Pack::fmadd(a.re, b.im, Pack::fmadd(a.im, b.re, c.im));
+    return x;
+}
+
+// 1 / a
+template <class Pack>
+ComplexPack<Pack> inverse(const ComplexPack<Pack> &a) {
+    typename Pack::type scale = Pack::div(Pack::set1(1.0), Pack::fmadd(a.im, a.im, Pack::mul(a.re, a.re)));
+    ComplexPack<Pack> x;
+    x.re = Pack::mul(a.re, scale);
+    x.im = Pack::mul(Pack::sub(Pack::set1(0.0), a.im), scale);
+    return x;
+}
+
+// Principal square root with the branch cut of std::sqrt
+template <class Pack>
+ComplexPack<Pack> sqrt(const ComplexPack<Pack> &a) {
+    typedef typename Pack::type T;
+    T r = Pack::sqrt(Pack::fmadd(a.im, a.im, Pack::mul(a.re, a.re)));
+    T t = Pack::sqrt(Pack::mul(Pack::set1(0.5), Pack::add(Pack::abs(a.re), r)));
+    T u = Pack::div(Pack::abs(a.im), Pack::add(t, t));
+    typename Pack::mask negative = Pack::less(a.re, Pack::set1(0.0));
+    ComplexPack<Pack> x;
+    x.re = Pack::select(negative, u, t);
+    x.im = Pack::copysign(Pack::select(negative, t, u), a.im);
+    return x;
+}
+
+// Real sin(x) and cos(x), Cephes polynomials on [-pi/4, pi/4] after the
+// reduction by the nearest multiple of pi/2, the float packs use the shorter
+// single precision polynomials
+template <class Pack>
+void sincos(typename Pack::type x, typename Pack::type *sinX, typename Pack::type *cosX) {
+    typedef typename Pack::type T;
+    const bool single = sizeof(typename Pack::scalar) == sizeof(float);
+    // pi/2 split in three parts of decreasing magnitude
+    const double PIO2_1 = single ? 1.5703125 : 1.57079625129699707031e0;
+    const double PIO2_2 = single ? 4.837512969970703125e-4 : 7.54978941586159635336e-8;
+    const double PIO2_3 = single ? 7.54978995489188216e-8 : 5.39030285815811905290e-15;
+
+    T q = Pack::round(Pack::mul(x, Pack::set1(2.0 / M_PI)));
+    T r = Pack::fnmadd(q, Pack::set1(PIO2_1), x);
+    r = Pack::fnmadd(q, Pack::set1(PIO2_2), r);
+    r = Pack::fnmadd(q, Pack::set1(PIO2_3), r);
+    T z = Pack::mul(r, r);
+
+    T sinR, cosR;
+    if (single) {
+        T ps = Pack::set1(-1.9515295891e-4);
+        ps = Pack::fmadd(ps, z, Pack::set1(8.3321608736e-3));
+        ps = Pack::fmadd(ps, z, Pack::set1(-1.6666654611e-1));
+        sinR = Pack::fmadd(Pack::mul(r, z), ps, r);
+
+        T pc = Pack::set1(2.443315711809948e-5);
+        pc = Pack::fmadd(pc, z, Pack::set1(-1.388731625493765e-3));
+        pc = Pack::fmadd(pc, z, Pack::set1(4.166664568298827e-2));
+        cosR = Pack::fmadd(Pack::mul(z, z), pc, Pack::fnmadd(Pack::set1(0.5), z, Pack::set1(1.0)));
+    } else {
+        T ps = Pack::set1(1.58962301576546568060e-10);
+        ps = Pack::fmadd(ps, z, Pack::set1(-2.50507477628578072866e-8));
+        ps = Pack::fmadd(ps, z, Pack::set1(2.75573136213857245213e-6));
+        ps = Pack::fmadd(ps, z, Pack::set1(-1.98412698295895385996e-4));
+        ps = Pack::fmadd(ps, z, Pack::set1(8.33333333332211858878e-3));
+        ps = Pack::fmadd(ps, z, Pack::set1(-1.66666666666666307295e-1));
+        sinR = Pack::fmadd(Pack::mul(r, z), ps, r);
+
+        T pc = Pack::set1(-1.13585365213876817300e-11);
+        pc = Pack::fmadd(pc, z, Pack::set1(2.08757008419747316778e-9));
+        pc = Pack::fmadd(pc, z, Pack::set1(-2.75573141792967388112e-7));
+        pc = Pack::fmadd(pc, z, Pack::set1(2.48015872888517045348e-5));
+        pc = Pack::fmadd(pc, z, Pack::set1(-1.38888888888730564116e-3));
+        pc = Pack::fmadd(pc, z, Pack::set1(4.16666666666665929218e-2));
+        cosR = Pack::fmadd(Pack::mul(z, z), pc, Pack::fnmadd(Pack::set1(0.5), z, Pack::set1(1.0)));
+    }
+
+    // quadrant k = q mod 4
+    T k = Pack::fnmadd(Pack::set1(4.0), Pack::floor(Pack::mul(q, Pack::set1(0.25))), q);
+    T half = Pack::floor(Pack::mul(k, Pack::set1(0.5)));
+    typename Pack::mask odd = Pack::equal(Pack::fnmadd(Pack::set1(2.0), half, k), Pack::set1(1.0));
+    // sin is negated in the quadrants 2 and 3, cos in 1 and 2
+    T sinSign = Pack::fnmadd(Pack::set1(2.0), half, Pack::set1(1.0));
+    T cosSign = Pack::select(Pack::less(Pack::abs(Pack::sub(k, Pack::set1(1.5))), Pack::set1(1.0)),
+                             Pack::set1(-1.0), Pack::set1(1.0));
+
+    *sinX = Pack::mul(sinSign, Pack::select(odd, cosR, sinR));
+    *cosX = Pack::mul(cosSign, Pack::select(odd, sinR, cosR));
+}
+
+// Real cosh(y) and sinh(y), |y| is clamped to 700 (88 for the float packs)
+template <class Pack>
+void coshsinh(typename Pack::type y, typename Pack::type *coshY, typename Pack::type *sinhY) {
+    typedef typename Pack::type T;
+    const bool single = sizeof(typename Pack::scalar) == sizeof(float);
+    const double maximum = single ? 88.0 : 700.0;
+    // ln 2 split in two parts
+    const double LN2_1 = single ? 6.93359375e-1 : 6.93145751953125e-1;
+    const double LN2_2 = single ? -2.12194440e-4 : 1.42860682030941723212e-6;
+    y = Pack::max(Pack::min(y, Pack::set1(maximum)), Pack::set1(-maximum));
+
+    // exp(y), Cephes
+    T n = Pack::round(Pack::mul(y, Pack::set1(1.4426950408889634073599)));
+    T r = Pack::fnmadd(n, Pack::set1(LN2_1), y);
+    r = Pack::fnmadd(n, Pack::set1(LN2_2), r);
+    T rr = Pack::mul(r, r);
+    T p = Pack::set1(1.26177193074810590878e-4);
+    p = Pack::fmadd(p, rr, Pack::set1(3.02994407707441961300e-2));
+    p = Pack::fmadd(p, rr, Pack::set1(9.99999999999999999910e-1));
+    p = Pack::mul(p, r);
+    T q = Pack::set1(3.00198505138664455042e-6);
+    q = Pack::fmadd(q, rr, Pack::set1(2.52448340349684104192e-3));
+    q = Pack::fmadd(q, rr, Pack::set1(2.27265548208155028766e-1));
+    q = Pack::fmadd(q, rr, Pack::set1(2.00000000000000000009e0));
+    T e = Pack::fmadd(Pack::set1(2.0), Pack::div(p, Pack::sub(q, p)), Pack::set1(1.0));
+    e = Pack::mul(e, Pack::exp2i(n));
+    T inverseE = Pack::div(Pack::set1(1.0), e);
+
+    *coshY = Pack::mul(Pack::set1(0.5), Pack::add(e, inverseE));
+
+    // Taylor series of sinh where exp(y) - exp(-y) cancels
+    T z = Pack::mul(y, y);
+    T s = Pack::set1(1.0 / 1307674368000.0);
+    s = Pack::fmadd(s, z, Pack::set1(1.0 / 6227020800.0));
+    s = Pack::fmadd(s, z, Pack::set1(1.0 / 39916800.0));
+    s = Pack::fmadd(s, z, Pack::set1(1.0 / 362880.0));
+    s = Pack::fmadd(s, z, Pack::set1(1.0 / 5040.0));
+    s = Pack::fmadd(s, z, Pack::set1(1.0 / 120.0));
+    s = Pack::fmadd(s, z, Pack::set1(1.0 / 6.0));
+    s = Pack::fmadd(s, z, Pack::set1(1.0));
+    s = Pack::mul(s, y);
+
+    *sinhY = Pack::select(Pack::less(Pack::abs(y), Pack::set1(0.5)), s,
+                          Pack::mul(Pack::set1(0.5), Pack::sub(e, inverseE)));
+}
+
+// cos(z) and sin(z) together, see the scalar sincos
+template <class Pack>
+void sincos(const ComplexPack<Pack> &z, ComplexPack<Pack> *c, ComplexPack<Pack> *s) {
+    typename Pack::type sinX, cosX, coshY, sinhY;
+    sincos<Pack>(z.re, &sinX, &cosX);
+    coshsinh<Pack>(z.im, &coshY, &sinhY);
+
+    c->re = Pack::mul(cosX, coshY);
+    c->im = Pack::sub(Pack::set1(0.0), Pack::mul(sinX, sinhY));
+    s->re = Pack::mul(sinX, coshY);
+    s->im = Pack::mul(cosX, sinhY);
+}
+
+// Lanes complex numbers stored as two planes
+template <std::size_t Lanes, class T = double>
+struct ComplexBatch {
+    void set(std::size_t l, std::complex<T> a) {
+        re[l] = a.real();
+        im[l] = a.imag();
+    }
+    std::complex<T> get(std::size_t l) const {
+        return std::complex<T>(re[l], im[l]);
+    }
+
+    alignas(64) T re[Lanes];
+    alignas(64) T im[Lanes];
+};
+
+// Lanes independent 2x2 complex matrices
+template <std::size_t Lanes, class T = double>
+struct Matrix22Batch {
+    enum { lanes = Lanes };
+
+    void set(std::size_t l, const BasicMatrix22<T> &a) {
+        m11.set(l, a.m11);
+        m12.set(l, a.m12);
+        m21.set(l, a.m21);
+        m22.set(l, a.m22);
+    }
+    BasicMatrix22<T> get(std::size_t l) const {
+        return BasicMatrix22<T>(m11.get(l), m12.get(l), m21.get(l), m22.get(l));
+    }
+
+    ComplexBatch<Lanes, T> m11;
+    ComplexBatch<Lanes, T> m12;
+    ComplexBatch<Lanes, T> m21;
+    ComplexBatch<Lanes, T> m22;
+};
+
+// a *= b for every lane
+template <class Pack, std::size_t Lanes>
+void multiply(Matrix22Batch<Lanes, typename Pack::scalar> *a,
+              const Matrix22Batch<Lanes, typename Pack::scalar> &b) {
+    typedef ComplexPack<Pack> C;
+    for (std::size_t l = 0; l < Lanes; l += Pack::size) {
+        C a11 = C::load(a->m11.re + l, a->m11.im + l);
+        C a12 = C::load(a->m12.re + l, a->m12.im + l);
+        C a21 = C::load(a->m21.re + l, a->m21.im + l);
+        C a22 = C::load(a->m22.re + l, a->m22.im + l);
+        C b11 = C::load(b.m11.re + l, b.m11.im + l);
+        C b12 = C::load(b.m12.re + l, b.m12.im + l);
+        C b21 = C::load(b.m21.re + l, b.m21.im + l);
+        C b22 = C::load(b.m22.re + l, b.m22.im + l);
+
+        fmadd(a12, b21, a11 * b11).store(a->m11.re + l, a->m11.im + l);
+        fmadd(a12, b22, a11 * b12).store(a->m12.re + l, a->m12.im + l);
+        fmadd(a22, b21, a21 * b11).store(a->m21.re + l, a->m21.im + l);
+        fmadd(a22, b22, a21 * b12).store(a->m22.re + l, a->m22.im + l);
+    }
+}
+
+// a *= ( c    x12 )
+//      ( x21  c   )  for every lane, the form of the layer matrices
+template <class Pack, std::size_t Lanes>
+void multiply_layer(Matrix22Batch<Lanes, typename Pack::scalar> *a,
+                    const ComplexBatch<Lanes, typename Pack::scalar> &c,
+                    const ComplexBatch<Lanes, typename Pack::scalar> &x12,
+                    const ComplexBatch<Lanes, typename Pack::scalar> &x21) {
+    typedef ComplexPack<Pack> C;
+    for (std::size_t l = 0; l < Lanes; l += Pack::size) {
+        C a11 = C::load(a->m11.re + l, a->m11.im + l);
+        C a12 = C::load(a->m12.re + l, a->m12.im + l);
+        C a21 = C::load(a->m21.re + l, a->m21.im + l);
+        C a22 = C::load(a->m22.re + l, a->m22.im + l);
+        C cc = C::load(c.re + l, c.im + l);
+        C b12 = C::load(x12.re + l, x12.im + l);
+        C b21 = C::load(x21.re + l, x21.im + l);
+
+        fmadd(a12, b21, a11 * cc).store(a->m11.re + l, a->m11.im + l);
+        fmadd(a12, cc, a11 * b12).store(a->m12.re + l, a->m12.im + l);
+        fmadd(a22, b21, a21 * cc).store(a->m21.re + l, a->m21.im + l);
+        fmadd(a22, cc, a21 * b12).store(a->m22.re + l, a->m22.im + l);
+    }
+}
+
+// Incident medium matrices for every lane
+template <std::size_t Lanes, class T>
+void incident_matrices_PS(const std::complex<T> *incidentCosTheta, const std::complex<T> *nIncident,
+                          Matrix22Batch<Lanes, T> *MatP, Matrix22Batch<Lanes, T> *MatS) {
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        BasicMatrix22<T> P, S;
+        incident_matrices_PS(incidentCosTheta[l], nIncident[l], &P, &S);
+        MatP->set(l, P);
+        MatS->set(l, S);
+    }
+}
+
+// Multiply every lane by its layer matrices C_p and C_s
+// n, nSinThetaSquared and phaseScale are arrays of Lanes values, see the
+// scalar multiply_layer_PS. The square root and the trigonometric functions
+// are evaluated on the packs of the type Pack.
+template <std::size_t Lanes, class T, class Pack = typename NativePackOf<T>::type>
+void multiply_layer_PS(const std::complex<T> *n, const std::complex<T> *nSinThetaSquared,
+                       const T *phaseScale,
+                       Matrix22Batch<Lanes, T> *MatP, Matrix22Batch<Lanes, T> *MatS) {
+    typedef ComplexPack<Pack> C;
+    static_assert(Lanes % Pack::size == 0, "Lanes must be a multiple of the pack size");
+
+    ComplexBatch<Lanes, T> nBatch, nSinThetaSquaredBatch;
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        nBatch.set(l, n[l]);
+        nSinThetaSquaredBatch.set(l, nSinThetaSquared[l]);
+    }
+
+    ComplexBatch<Lanes, T> c, p12, p21, s12, s21;
+    for (std::size_t l = 0; l < Lanes; l += Pack::size) {
+        C nL = C::load(nBatch.re + l, nBatch.im + l);
+        C nSin = C::load(nSinThetaSquaredBatch.re + l, nSinThetaSquaredBatch.im + l);
+
+        C inverseN = inverse(nL);
+        C ratio = nSin * (inverseN * inverseN);
+        C argument;
+        argument.re = Pack::sub(Pack::set1(1.0), ratio.re);
+        argument.im = Pack::sub(Pack::set1(0.0), ratio.im);
+        C cosTheta = sqrt(argument);
+        C inverseCosTheta = inverse(cosTheta);
+
+        C deltaLayer = nL * cosTheta;
+        typename Pack::type scale = Pack::load(phaseScale + l);
+        deltaLayer.re = Pack::mul(scale, deltaLayer.re);
+        deltaLayer.im = Pack::mul(scale, deltaLayer.im);
+
+        C cc, ss;
+        sincos(deltaLayer, &cc, &ss);
+        // -i s
+        C js;
+        js.re = ss.im;
+        js.im = Pack::sub(Pack::set1(0.0), ss.re);
+
+        cc.store(c.re + l, c.im + l);
+        (js * cosTheta * inverseN).store(p12.re + l, p12.im + l);
+        (js * nL * inverseCosTheta).store(p21.re + l, p21.im + l);
+        (js * inverseCosTheta * inverseN).store(s12.re + l, s12.im + l);
+        (js * nL * cosTheta).store(s21.re + l, s21.im + l);
+    }
+
+    multiply_layer<Pack>(MatP, c, p12, p21);
+    multiply_layer<Pack>(MatS, c, s12, s21);
+}
+
+// Multiply every lane by its exit medium matrices, exitCosTheta receives
+// Lanes values
+template <std::size_t Lanes, class T, class Pack = typename NativePackOf<T>::type>
+void multiply_exit_PS(const std::complex<T> *nSinThetaSquared, const std::complex<T> *nExit,
+                      Matrix22Batch<Lanes, T> *MatP, Matrix22Batch<Lanes, T> *MatS,
+                      std::complex<T> *exitCosTheta) {
+    const std::complex<T> one(1);
+    Matrix22Batch<Lanes, T> BP, BS;
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        exitCosTheta[l] = std::sqrt(T(1) - nSinThetaSquared[l] / (nExit[l] * nExit[l]));
+        BP.set(l, BasicMatrix22<T>(exitCosTheta[l], exitCosTheta[l], nExit[l], -nExit[l]));
+        BS.set(l, BasicMatrix22<T>(one, one, nExit[l] * exitCosTheta[l], -nExit[l] * exitCosTheta[l]));
+    }
+    multiply<Pack>(MatP, BP);
+    multiply<Pack>(MatS, BS);
+}
+
+// Spectral sweep with Lanes wavelengths going through the layer loop together,
+// in the precision T and on the packs of the type Pack
+template <std::size_t Lanes, class T, class Pack = typename NativePackOf<T>::type>
+void spectral_sweep_simd(std::complex<T> incidentCosTheta,
+                         const std::complex<T> *nIncident, const std::complex<T> *nExit,
+                         const T *thicknesses, std::size_t layerCount,
+                         const std::complex<T> *refractiveIndices,
+                         const T *wavelengths, std::size_t wavelengthCount,
+                         T *reflectanceP, T *reflectanceS,
+                         T *transmittanceP, T *transmittanceS) {
+    typedef std::complex<T> C;
+    C incidentSinThetaSquared = T(1) - incidentCosTheta * incidentCosTheta;
+
+    for (std::size_t k0 = 0; k0 < wavelengthCount; k0 += Lanes) {
+        // the lanes after the last wavelength repeat it and are discarded
+        std::size_t index[Lanes];
+        C cosTheta[Lanes], nI[Lanes], nE[Lanes], nSinThetaSquared[Lanes];
+        T waveNumber[Lanes];
+        for (std::size_t l = 0; l < Lanes; ++l) {
+            index[l] = std::min(k0 + l, wavelengthCount - 1);
+            cosTheta[l] = incidentCosTheta;
+            nI[l] = nIncident[index[l]];
+            nE[l] = nExit[index[l]];
+            nSinThetaSquared[l] = incidentSinThetaSquared * (nI[l] * nI[l]);
+            waveNumber[l] = T(2.0 * M_PI) / wavelengths[index[l]];
+        }
+
+        Matrix22Batch<Lanes, T> MatP, MatS;
+        incident_matrices_PS(cosTheta, nI, &MatP, &MatS);
+
+        const C *n = refractiveIndices;
+        for (std::size_t i = 0; i < layerCount; ++i, n += wavelengthCount) {
+            C nLayer[Lanes];
+            T phaseScale[Lanes];
+            for (std::size_t l = 0; l < Lanes; ++l) {
+                nLayer[l] = n[index[l]];
+                phaseScale[l] = waveNumber[l] * thicknesses[i];
+            }
+            multiply_layer_PS<Lanes, T, Pack>(nLayer, nSinThetaSquared, phaseScale, &MatP, &MatS);
+        }
+
+        C exitCosTheta[Lanes];
+        multiply_exit_PS<Lanes, T, Pack>(nSinThetaSquared, nE, &MatP, &MatS, exitCosTheta);
+
+        for (std::size_t l = 0; l < Lanes && k0 + l < wavelengthCount; ++l) {
+            std::size_t k = k0 + l;
+            power_coefficients_PS(MatP.get(l), MatS.get(l), incidentCosTheta, nI[l],
+                                  exitCosTheta[l], nE[l],
+                                  reflectanceP + k, reflectanceS + k,
+                                  transmittanceP + k, transmittanceS + k);
+        }
+    }
+}
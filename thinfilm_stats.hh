@@ -0,0 +1,254 @@
+#ifndef THINFILM_STATS_H
+#define THINFILM_STATS_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Counters and phase timers of the kernels
+//
+// Compiled in with -DTHINFILM_STATS=1, the default removes the macros of the
+// kernels entirely. Every thread counts in its own block of relaxed atomics
+// (one writer, no lock and no shared cache line on the hot path), the blocks
+// of the finished threads are folded into a global one. statistics() sums
+// them, thread_statistics() returns the live threads one by one.
+//
+//     THINFILM_COUNT(counter, n)   add n to a Counter
+//     THINFILM_TIMER(timer)        start a phase clock
+//     THINFILM_LAP(timer, phase)   add the time since the last lap to a Phase
+
+#ifndef THINFILM_STATS
+#define THINFILM_STATS 0
+#endif
+
+#if THINFILM_STATS
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#endif
+
+namespace thinfilm {
+
+enum class Counter {
+    // single wavelength evaluations of a stack and layers gone through
+    Evaluations,
+    LayerEvaluations,
+    // spectral and angular sweeps, a SIMD sweep counts once
+    Sweeps,
+    // evaluations that Engine::Auto sent to the scattering matrix engine
+    ScatteringFallbacks,
+    ResultCacheHits,
+    ResultCacheMisses,
+    PrefixCacheHits,
+    MaterialCacheHits,
+    MaterialCacheMisses,
+    // problems of the binary stream
+    StreamProblems,
+    Count
+};
+
+enum class Phase {
+    // angles, exit medium and initial matrices
+    Setup,
+    LayerLoop,
+    // power coefficients and stores
+    Output,
+    // reading and writing of the binary stream
+    IO,
+    Count
+};
+
+inline const char *counter_name(Counter counter) {
+    static const char *const names[] = {
+        "evaluations", "layer_evaluations", "sweeps", "scattering_fallbacks",
+        "result_cache_hits", "result_cache_misses", "prefix_cache_hits",
+        "material_cache_hits", "material_cache_misses", "stream_problems"
+    };
+    return names[int(counter)];
+}
+
+inline const char *phase_name(Phase phase) {
+    static const char *const names[] = { "setup", "layer_loop", "output", "io" };
+    return names[int(phase)];
+}
+
+struct Statistics {
+    Statistics()
+        : counters(), nanoseconds() {
+    }
+
+    std::uint64_t operator[](Counter counter) const {
+        return counters[int(counter)];
+    }
+
+    std::uint64_t counters[int(Counter::Count)];
+    std::uint64_t nanoseconds[int(Phase::Count)];
+};
+
+// Write s as a JSON object, {"enabled": false} without THINFILM_STATS
+inline void write_statistics_json(std::ostream &out, const Statistics &s) {
+    out << "{\"enabled\": " << (THINFILM_STATS ? "true" : "false");
+    for (int c = 0; c < int(Counter::Count); ++c) {
+        out << ", \"" << counter_name(Counter(c)) << "\": " << s.counters[c];
+    }
+    for (int p = 0; p < int(Phase::Count); ++p) {
+        out << ", \"" << phase_name(Phase(p)) << "_ns\": " << s.nanoseconds[p];
+    }
+    out << "}";
+}
+
+#if THINFILM_STATS
+
+namespace detail {
+
+struct alignas(64) StatisticsBlock {
+    StatisticsBlock()
+        : counters(), nanoseconds() {
+    }
+
+    // only the owner thread writes, a load and a store are enough
+    void add(std::atomic<std::uint64_t> &value, std::uint64_t n) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void add_to(Statistics *s) const {
+        for (int c = 0; c < int(Counter::Count); ++c) {
+            s->counters[c] += counters[c].load(std::memory_order_relaxed);
+        }
+        for (int p = 0; p < int(Phase::Count); ++p) {
+            s->nanoseconds[p] += nanoseconds[p].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<std::uint64_t> counters[int(Counter::Count)];
+    std::atomic<std::uint64_t> nanoseconds[int(Phase::Count)];
+};
+
+struct StatisticsRegistry {
+    std::mutex mutex;
+    std::vector<StatisticsBlock *> live;
+    // sums of the finished threads
+    Statistics retired;
+};
+
+inline StatisticsRegistry &statistics_registry() {
+    // never destroyed, threads may finish after the static destructors
+    static StatisticsRegistry *registry = new StatisticsRegistry;
+    return *registry;
+}
+
+struct ThreadStatistics {
+    ThreadStatistics() {
+        StatisticsRegistry &registry = statistics_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.live.push_back(&block);
+    }
+
+    ~ThreadStatistics() {
+        StatisticsRegistry &registry = statistics_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        block.add_to(&registry.retired);
+        for (std::size_t t = 0; t < registry.live.size(); ++t) {
+            if (registry.live[t] == &block) {
+                registry.live.erase(registry.live.begin() + t);
+                break;
+            }
+        }
+    }
+
+    StatisticsBlock block;
+};
+
+inline StatisticsBlock &thread_block() {
+    thread_local ThreadStatistics statistics;
+    return statistics.block;
+}
+
+inline void count(Counter counter, std::uint64_t n) {
+    StatisticsBlock &block = thread_block();
+    block.add(block.counters[int(counter)], n);
+}
+
+class PhaseTimer {
+public:
+    PhaseTimer()
+        : last_(std::chrono::steady_clock::now()) {
+    }
+
+    void lap(Phase phase) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        StatisticsBlock &block = thread_block();
+        block.add(block.nanoseconds[int(phase)],
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count());
+        last_ = now;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last_;
+};
+
+}
+
+#define THINFILM_COUNT(counter, n) ::thinfilm::detail::count(::thinfilm::Counter::counter, (n))
+#define THINFILM_TIMER(timer) ::thinfilm::detail::PhaseTimer timer
+#define THINFILM_LAP(timer, phase) timer.lap(::thinfilm::Phase::phase)
+
+// Sums of all the threads since the start or the last reset
+inline Statistics statistics() {
+    detail::StatisticsRegistry &registry = detail::statistics_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    Statistics s = registry.retired;
+    for (std::size_t t = 0; t < registry.live.size(); ++t) {
+        registry.live[t]->add_to(&s);
+    }
+    return s;
+}
+
+// One entry per live thread that counted something
+inline std::vector<Statistics> thread_statistics() {
+    detail::StatisticsRegistry &registry = detail::statistics_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    std::vector<Statistics> threads(registry.live.size());
+    for (std::size_t t = 0; t < registry.live.size(); ++t) {
+        registry.live[t]->add_to(&threads[t]);
+    }
+    return threads;
+}
+
+// Only exact while the kernels are idle
+inline void reset_statistics() {
+    detail::StatisticsRegistry &registry = detail::statistics_registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.retired = Statistics();
+    for (std::size_t t = 0; t < registry.live.size(); ++t) {
+        detail::StatisticsBlock &block = *registry.live[t];
+        for (int c = 0; c < int(Counter::Count); ++c) {
+            block.counters[c].store(0, std::memory_order_relaxed);
+        }
+        for (int p = 0; p < int(Phase::Count); ++p) {
+            block.nanoseconds[p].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+#else
+
+#define THINFILM_COUNT(counter, n) ((void)0)
+#define THINFILM_TIMER(timer) ((void)0)
+#define THINFILM_LAP(timer, phase) ((void)0)
+
+inline Statistics statistics() {
+    return Statistics();
+}
+
+inline std::vector<Statistics> thread_statistics() {
+    return std::vector<Statistics>();
+}
+
+inline void reset_statistics() {
+}
+
+#endif
+
+}
+#endif
@@ -0,0 +1,280 @@
+#ifndef THINFILM_STREAM_H
+#define THINFILM_STREAM_H
+
+#include "thinfilm_batch.hh"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+// Framed binary stream of problems
+//
+// A problem is a frame of native endian values
+//
+//     uint32  n, the number of layers
+//     double  real and imaginary parts of incidentCosTheta
+//     double  real and imaginary parts of nIncident
+//     double  real and imaginary parts of nExit
+//     n times
+//         double  real and imaginary parts of refractiveIndex
+//         double  thickness
+//
+// in the order of the text input of thinfilm.cc, with n at most
+// maximumStreamLayers. The result of a problem is 4 doubles: reflectanceP,
+// reflectanceS, transmittanceP, transmittanceS.
+
+namespace thinfilm {
+
+// Frames of more layers are rejected before anything is allocated for them
+const std::uint32_t maximumStreamLayers = 1u << 20;
+
+// Problems read together and evaluated in parallel
+struct ProblemChunk {
+    void clear() {
+        stacks.clear();
+        incidentCosTheta.clear();
+        nIncident.clear();
+        nExit.clear();
+    }
+
+    std::size_t size() const {
+        return stacks.size();
+    }
+
+    StackArena stacks;
+    std::vector<complex> incidentCosTheta;
+    std::vector<complex> nIncident;
+    std::vector<complex> nExit;
+    // 4 values per problem
+    std::vector<double> results;
+
+    // frame being decoded
+    std::vector<double> frame;
+    std::vector<double> thicknesses;
+    std::vector<complex> refractiveIndices;
+};
+
+// Source reading a FILE
+class FileSource {
+public:
+    explicit FileSource(std::FILE *file) : file_(file) {
+    }
+
+    // false at the end of the input
+    bool read(void *data, std::size_t size) {
+        return std::fread(data, 1, size, file_) == size;
+    }
+
+    // false if less than size bytes remain, unknown for a FILE
+    bool available(std::size_t) const {
+        return true;
+    }
+
+private:
+    std::FILE *file_;
+};
+
+// Source reading a buffer, e.g. a memory mapped file
+class MemorySource {
+public:
+    MemorySource(const void *data, std::size_t size)
+        : data_(static_cast<const char *>(data)), size_(size) {
+    }
+
+    bool read(void *data, std::size_t size) {
+        if (size > size_) {
+            return false;
+        }
+        std::memcpy(data, data_, size);
+        data_ += size;
+        size_ -= size;
+        return true;
+    }
+
+    bool available(std::size_t size) const {
+        return size <= size_;
+    }
+
+private:
+    const char *data_;
+    std::size_t size_;
+};
+
+enum class ReadStatus { Ok, End, Truncated };
+
+// Read a frame and append it to the chunk, End if the input ends before it,
+// Truncated if the input ends in the frame or its layer count is invalid
+template <class Source>
+ReadStatus read_problem(Source &source, ProblemChunk *chunk) {
+    // the first byte alone tells the end of the input from a cut count
+    std::uint32_t n;
+    char *count = reinterpret_cast<char *>(&n);
+    if (!source.read(count, 1)) {
+        return ReadStatus::End;
+    }
+    if (!source.read(count + 1, sizeof(n) - 1)) {
+        return ReadStatus::Truncated;
+    }
+
+    if (n > maximumStreamLayers || !source.available((6 + 3 * std::size_t(n)) * sizeof(double))) {
+        return ReadStatus::Truncated;
+    }
+
+    chunk->frame.resize(6 + 3 * std::size_t(n));
+    if (!source.read(chunk->frame.data(), chunk->frame.size() * sizeof(double))) {
+        return ReadStatus::Truncated;
+    }
+
+    const double *x = chunk->frame.data();
+    chunk->incidentCosTheta.push_back(complex(x[0], x[1]));
+    chunk->nIncident.push_back(complex(x[2], x[3]));
+    chunk->nExit.push_back(complex(x[4], x[5]));
+
+    chunk->thicknesses.resize(n);
+    chunk->refractiveIndices.resize(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        const double *layer = x + 6 + 3 * i;
+        chunk->refractiveIndices[i] = complex(layer[0], layer[1]);
+        chunk->thicknesses[i] = layer[2];
+    }
+    chunk->stacks.add(chunk->thicknesses.data(), chunk->refractiveIndices.data(), n);
+    return ReadStatus::Ok;
+}
+
+// Evaluate all the problems of the chunk on the pool
+inline void evaluate_chunk(WorkStealingPool &pool, ProblemChunk *chunk) {
+    struct Task {
+        void operator()(std::size_t p) const {
+            double *result = &chunk->results[4 * p];
+            reflectance_transmittance(chunk->incidentCosTheta[p], chunk->nIncident[p],
+                                      chunk->nExit[p], chunk->stacks[p],
+                                      result, result + 1, result + 2, result + 3);
+        }
+
+        ProblemChunk *chunk;
+    };
+
+    chunk->results.resize(4 * chunk->size());
+    Task task = { chunk };
+    pool.parallel_for(chunk->size(), task);
+}
+
+// Bounded blocking queue between two stages of the pipeline
+template <class T>
+class Channel {
+public:
+    explicit Channel(std::size_t capacity)
+        : items_(capacity), begin_(0), count_(0), closed_(false) {
+    }
+
+    void push(const T &item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return count_ < items_.size(); });
+        items_[(begin_ + count_) % items_.size()] = item;
+        ++count_;
+        not_empty_.notify_one();
+    }
+
+    // false once the channel is closed and empty
+    bool pop(T *item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return count_ > 0 || closed_; });
+        if (count_ == 0) {
+            return false;
+        }
+        *item = items_[begin_];
+        begin_ = (begin_ + 1) % items_.size();
+        --count_;
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+private:
+    std::vector<T> items_;
+    std::size_t begin_;
+    std::size_t count_;
+    bool closed_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+// Read, evaluate and write a whole stream of problems
+//
+// Reading (this thread), evaluation (on the pool, driven by a second thread)
+// and writing (a third thread) run concurrently on a ring of chunks of
+// chunkSize problems. The chunks are reused, once they have grown the
+// pipeline does not allocate. The results are written in input order.
+// Returns false if the input ends in the middle of a frame or if writing
+// fails, the input is not read further after a write error
+template <class Source>
+bool run_binary_pipeline(Source &source, std::FILE *output, WorkStealingPool &pool,
+                         std::size_t chunkSize = 4096) {
+    chunkSize = std::max<std::size_t>(chunkSize, 1);
+    const std::size_t chunkCount = 4;
+    std::vector<ProblemChunk> chunks(chunkCount);
+
+    Channel<ProblemChunk *> freeChunks(chunkCount), readChunks(chunkCount), evaluatedChunks(chunkCount);
+    for (std::size_t c = 0; c < chunkCount; ++c) {
+        freeChunks.push(&chunks[c]);
+    }
+
+    std::thread evaluator([&] {
+        ProblemChunk *chunk = 0;
+        while (readChunks.pop(&chunk)) {
+            evaluate_chunk(pool, chunk);
+            evaluatedChunks.push(chunk);
+        }
+        evaluatedChunks.close();
+    });
+
+    // read by the reading loop, which stops at the first write error
+    std::atomic<bool> written(true);
+    std::thread writer([&] {
+        ProblemChunk *chunk = 0;
+        while (evaluatedChunks.pop(&chunk)) {
+            THINFILM_TIMER(timer);
+            if (written && std::fwrite(chunk->results.data(), sizeof(double), chunk->results.size(),
+                                       output) != chunk->results.size()) {
+                written = false;
+            }
+            THINFILM_LAP(timer, IO);
+            freeChunks.push(chunk);
+        }
+        if (std::fflush(output) != 0) {
+            written = false;
+        }
+    });
+
+    ReadStatus status = ReadStatus::Ok;
+    while (status == ReadStatus::Ok && written) {
+        ProblemChunk *chunk = 0;
+        freeChunks.pop(&chunk);
+        chunk->clear();
+        THINFILM_TIMER(timer);
+        while (chunk->size() < chunkSize &&
+               (status = read_problem(source, chunk)) == ReadStatus::Ok) {
+        }
+        THINFILM_LAP(timer, IO);
+        THINFILM_COUNT(StreamProblems, chunk->size());
+        if (chunk->size() > 0) {
+            readChunks.push(chunk);
+        } else {
+            freeChunks.push(chunk);
+        }
+    }
+    readChunks.close();
+
+    evaluator.join();
+    writer.join();
+    return status == ReadStatus::End && written;
+}
+
+}
+#endif
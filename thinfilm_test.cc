@@ -0,0 +1,135 @@
+/*
+   Regression tests of the evaluation paths, exits with 1 if one fails
+
+   g++ -O2 -pthread -o thinfilm_test thinfilm_test.cc && ./thinfilm_test
+
+   The SIMD sweeps are checked with every instruction set compiled in that
+   the CPU supports, THINFILM_SIMD=avx2 or scalar limits them.
+ */
+#include "thinfilm.hh"
+#include "thinfilm_fixed.hh"
+#include "thinfilm_simd.hh"
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char *test, const char *path) {
+    if (!ok) {
+        printf("FAILED %s (%s)\n", test, path);
+        ++failures;
+    }
+}
+
+// Instruction sets of the sweeps compiled in, up to the one detect_simd_path
+// chooses
+vector<thinfilm::SimdPath> simd_paths() {
+    vector<thinfilm::SimdPath> paths;
+    thinfilm::SimdPath best = thinfilm::detect_simd_path();
+    for (int p = int(thinfilm::SimdPath::Scalar); p <= int(best); ++p) {
+        thinfilm::SimdPath path = thinfilm::SimdPath(p);
+        if (thinfilm::simd_kernels(path).path == path) {
+            paths.push_back(path);
+        }
+    }
+    return paths;
+}
+
+// 50 wavelengths of n = 0.5 + 1.8i on glass at normal incidence, |Im delta|
+// is about 565: no light goes through and R is the one of the air-metal
+// interface, (0.25 + 3.24) / (2.25 + 3.24) = 0.635701. sinh(Im delta) is
+// finite in double but overflowed in the sincos of the layer loops once.
+const double thickMetalR = 0.635701;
+
+bool thick_metal_ok(double reflectanceP, double reflectanceS, double transmittanceP,
+                    double transmittanceS, double tolerance) {
+    return fabs(reflectanceP - thickMetalR) < tolerance && fabs(reflectanceS - thickMetalR) < tolerance &&
+           transmittanceP == 0.0 && transmittanceS == 0.0;
+}
+
+void test_thick_metal() {
+    const thinfilm::complex n(0.5, 1.8);
+    vector<thinfilm::Layer> layers(1);
+    layers[0].thickness = 50.0;
+    layers[0].refractiveIndex = n;
+    double reflectanceP = 0.0, reflectanceS = 0.0, transmittanceP = 1.0, transmittanceS = 1.0;
+
+    thinfilm::reflectance_transmittance(1.0, 1.0, 1.52, layers, &reflectanceP, &reflectanceS,
+                                        &transmittanceP, &transmittanceS);
+    check(thick_metal_ok(reflectanceP, reflectanceS, transmittanceP, transmittanceS, 1e-6),
+          "thick metal", "transfer matrices");
+
+    const thinfilm::Engine engines[] = { thinfilm::Engine::ScatteringMatrix, thinfilm::Engine::Auto };
+    const char *engineNames[] = { "scattering matrices", "Engine::Auto" };
+    for (int e = 0; e < 2; ++e) {
+        reflectanceP = reflectanceS = 0.0;
+        transmittanceP = transmittanceS = 1.0;
+        thinfilm::reflectance_transmittance(1.0, 1.0, 1.52, layers, &reflectanceP, &reflectanceS,
+                                            &transmittanceP, &transmittanceS, engines[e]);
+        check(thick_metal_ok(reflectanceP, reflectanceS, transmittanceP, transmittanceS, 1e-6),
+              "thick metal", engineNames[e]);
+    }
+
+    thinfilm::FixedStack<1> fixed = { layers[0] };
+    thinfilm::MediumTerms media(1.0, 1.0, 1.52);
+    reflectanceP = reflectanceS = 0.0;
+    transmittanceP = transmittanceS = 1.0;
+    thinfilm::reflectance_transmittance(media, fixed, &reflectanceP, &reflectanceS,
+                                        &transmittanceP, &transmittanceS);
+    check(thick_metal_ok(reflectanceP, reflectanceS, transmittanceP, transmittanceS, 1e-6),
+          "thick metal", "FixedStack");
+
+    // some wavelengths in the remainder of the lanes, the layer stays opaque
+    const size_t count = 3 * THINFILM_SIMD_FLOAT_LANES + 5;
+    vector<double> wavelengths(count);
+    vector<thinfilm::complex> indices(count, n), nIncident(count, 1.0), nExit(count, 1.52);
+    vector<float> wavelengthsFloat(count);
+    vector<complex<float> > indicesFloat(count, complex<float>(n)), nIncidentFloat(count, 1.0f),
+        nExitFloat(count, 1.52f);
+    for (size_t k = 0; k < count; ++k) {
+        wavelengths[k] = 0.5 + double(k) / count;
+        wavelengthsFloat[k] = float(wavelengths[k]);
+    }
+    const double thickness = 50.0;
+    const float thicknessFloat = 50.0f;
+
+    vector<thinfilm::SimdPath> paths = simd_paths();
+    for (size_t p = 0; p < paths.size(); ++p) {
+        thinfilm::SimdKernels kernels = thinfilm::simd_kernels(paths[p]);
+        const char *name = thinfilm::simd_path_name(paths[p]);
+
+        vector<double> rP(count, 0.0), rS(count, 0.0), tP(count, 1.0), tS(count, 1.0);
+        kernels.sweep(1.0, nIncident.data(), nExit.data(), &thickness, 1, indices.data(),
+                      wavelengths.data(), count, rP.data(), rS.data(), tP.data(), tS.data());
+        bool ok = true;
+        for (size_t k = 0; k < count; ++k) {
+            ok = ok && thick_metal_ok(rP[k], rS[k], tP[k], tS[k], 1e-6);
+        }
+        check(ok, "thick metal, SIMD sweep", name);
+
+        vector<float> rPFloat(count, 0.0f), rSFloat(count, 0.0f), tPFloat(count, 1.0f), tSFloat(count, 1.0f);
+        kernels.sweepFloat(1.0f, nIncidentFloat.data(), nExitFloat.data(), &thicknessFloat, 1,
+                           indicesFloat.data(), wavelengthsFloat.data(), count,
+                           rPFloat.data(), rSFloat.data(), tPFloat.data(), tSFloat.data());
+        ok = true;
+        for (size_t k = 0; k < count; ++k) {
+            ok = ok && thick_metal_ok(rPFloat[k], rSFloat[k], tPFloat[k], tSFloat[k], 1e-5);
+        }
+        check(ok, "thick metal, float SIMD sweep", name);
+    }
+}
+
+}
+
+int main() {
+    test_thick_metal();
+    if (failures != 0) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
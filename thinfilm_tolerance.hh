@@ -0,0 +1,283 @@
+#ifndef THINFILM_TOLERANCE_H
+#define THINFILM_TOLERANCE_H
+
+#include "thinfilm.hh"
+#include "thinfilm_batch.hh"
+#include "thinfilm_simd.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+// Monte Carlo tolerance analysis of a stack
+//
+// Every sample perturbs the thickness, the index and the extinction
+// coefficient of every layer and evaluates the spectrum with the SIMD sweep,
+// the samples run on the threads of a WorkStealingPool. The random numbers
+// are a function of (seed, sample, layer, parameter) instead of a sequence,
+// so a sample is the same whatever thread computes it and in whatever order.
+// The perturbed stacks and spectra are written in buffers allocated once per
+// worker, the samples do not allocate.
+
+namespace thinfilm {
+
+// 64 random bits, the value number counter of the stream seed
+// (splitmix64 of the counter)
+inline std::uint64_t counter_random(std::uint64_t seed, std::uint64_t counter) {
+    std::uint64_t z = seed + (counter + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+inline double counter_uniform(std::uint64_t seed, std::uint64_t counter) {
+    return double(counter_random(seed, counter) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Standard normal, Box-Muller of the values 2 counter and 2 counter + 1
+inline double counter_normal(std::uint64_t seed, std::uint64_t counter) {
+    double u = 1.0 - counter_uniform(seed, 2 * counter);
+    double v = counter_uniform(seed, 2 * counter + 1);
+    return std::sqrt(-2.0 * std::log(u)) * std::cos(2.0 * M_PI * v);
+}
+
+enum class ErrorDistribution {
+    Normal,
+    Uniform
+};
+
+// Manufacturing errors of a layer, standard deviations of a normal
+// distribution or half widths of a uniform one
+struct LayerTolerance {
+    LayerTolerance()
+        : thickness(0.0), n(0.0), k(0.0), distribution(ErrorDistribution::Normal) {
+    }
+    LayerTolerance(double thickness, double n = 0.0, double k = 0.0,
+                   ErrorDistribution distribution = ErrorDistribution::Normal)
+        : thickness(thickness), n(n), k(k), distribution(distribution) {
+    }
+
+    // in the unit of the thicknesses
+    double thickness;
+    // added to the real and imaginary parts of the index at every wavelength
+    double n;
+    double k;
+    ErrorDistribution distribution;
+};
+
+// Spectra of the perturbed copies of a nominal stack
+//
+// The nominal stack is given as for spectral_reflectance_transmittance:
+// thicknesses in the unit of the wavelengths and refractiveIndices[i *
+// wavelengthCount + k]. The perturbed thicknesses and extinction coefficients
+// are clamped at 0. The sample s is a function of the seed and of s only.
+class ToleranceAnalysis {
+public:
+    // The arrays are copied, tolerances holds layerCount values
+    ToleranceAnalysis(WorkStealingPool &pool, complex incidentCosTheta,
+                      const complex *nIncident, const complex *nExit,
+                      const double *thicknesses, std::size_t layerCount,
+                      const complex *refractiveIndices, const LayerTolerance *tolerances,
+                      const double *wavelengths, std::size_t wavelengthCount,
+                      std::uint64_t seed = 0)
+        : pool_(pool), incidentCosTheta_(incidentCosTheta),
+          nIncident_(nIncident, nIncident + wavelengthCount), nExit_(nExit, nExit + wavelengthCount),
+          thicknesses_(thicknesses, thicknesses + layerCount),
+          refractiveIndices_(refractiveIndices, refractiveIndices + layerCount * wavelengthCount),
+          tolerances_(tolerances, tolerances + layerCount),
+          wavelengths_(wavelengths, wavelengths + wavelengthCount), seed_(seed),
+          workers_(pool.size()) {
+        for (std::size_t w = 0; w < workers_.size(); ++w) {
+            workers_[w].thicknesses.resize(layerCount);
+            workers_[w].refractiveIndices.resize(layerCount * wavelengthCount);
+            workers_[w].spectra.resize(4 * wavelengthCount);
+        }
+    }
+
+    std::size_t layer_count() const {
+        return thicknesses_.size();
+    }
+
+    std::size_t wavelength_count() const {
+        return wavelengths_.size();
+    }
+
+    // Spectra of the samples [first, first + count), the outputs hold
+    // count * wavelengthCount values, the sample first + s at
+    // s * wavelengthCount + k
+    void sample(std::size_t first, std::size_t count,
+                double *reflectanceP, double *reflectanceS,
+                double *transmittanceP, double *transmittanceS) {
+        struct Task {
+            void operator()(std::size_t w, std::size_t s) const {
+                std::size_t out = s * analysis.wavelength_count();
+                analysis.evaluate(w, first + s, reflectanceP + out, reflectanceS + out,
+                                  transmittanceP + out, transmittanceS + out);
+            }
+
+            ToleranceAnalysis &analysis;
+            std::size_t first;
+            double *reflectanceP;
+            double *reflectanceS;
+            double *transmittanceP;
+            double *transmittanceS;
+        };
+
+        Task task = { *this, first, reflectanceP, reflectanceS, transmittanceP, transmittanceS };
+        pool_.parallel_for_worker(count, task);
+    }
+
+    // Fraction of the samples [0, sampleCount) accepted by
+    // accept(reflectanceP, reflectanceS, transmittanceP, transmittanceS), the
+    // spectra of one sample as arrays of wavelengthCount values
+    // accept is called concurrently
+    template <class Accept>
+    double yield(std::size_t sampleCount, const Accept &accept) {
+        struct Task {
+            void operator()(std::size_t w, std::size_t s) const {
+                std::size_t W = analysis.wavelength_count();
+                double *spectra = analysis.workers_[w].spectra.data();
+                analysis.evaluate(w, s, spectra, spectra + W, spectra + 2 * W, spectra + 3 * W);
+                if (accept(spectra, spectra + W, spectra + 2 * W, spectra + 3 * W)) {
+                    ++analysis.workers_[w].accepted;
+                }
+            }
+
+            ToleranceAnalysis &analysis;
+            const Accept &accept;
+        };
+
+        for (std::size_t w = 0; w < workers_.size(); ++w) {
+            workers_[w].accepted = 0;
+        }
+        Task task = { *this, accept };
+        pool_.parallel_for_worker(sampleCount, task);
+
+        std::size_t accepted = 0;
+        for (std::size_t w = 0; w < workers_.size(); ++w) {
+            accepted += workers_[w].accepted;
+        }
+        return sampleCount > 0 ? double(accepted) / double(sampleCount) : 0.0;
+    }
+
+    // Percentile spectra of the samples [0, sampleCount), quantiles in [0, 1]
+    // The outputs hold quantileCount * wavelengthCount values, the quantile q
+    // at the wavelength k at q * wavelengthCount + k. The order statistics are
+    // interpolated linearly.
+    // The spectra of all the samples are kept for the duration of the call
+    void percentiles(std::size_t sampleCount, const double *quantiles, std::size_t quantileCount,
+                     double *reflectanceP, double *reflectanceS,
+                     double *transmittanceP, double *transmittanceS) {
+        if (sampleCount == 0) {
+            return;
+        }
+        std::size_t W = wavelength_count();
+        std::vector<double> spectra(4 * sampleCount * W);
+        sample(0, sampleCount, &spectra[0], &spectra[sampleCount * W],
+               &spectra[2 * sampleCount * W], &spectra[3 * sampleCount * W]);
+
+        // one column of the samples per worker
+        std::vector<double> columns(workers_.size() * sampleCount);
+
+        struct Task {
+            void operator()(std::size_t w, std::size_t c) const {
+                // c = channel * W + k
+                std::size_t W = wavelengthCount;
+                const double *channel = spectra + (c / W) * sampleCount * W;
+                double *column = columns + w * sampleCount;
+                for (std::size_t s = 0; s < sampleCount; ++s) {
+                    column[s] = channel[s * W + c % W];
+                }
+                std::sort(column, column + sampleCount);
+
+                double *out = outputs[c / W] + c % W;
+                for (std::size_t q = 0; q < quantileCount; ++q) {
+                    double position = std::min(std::max(quantiles[q], 0.0), 1.0) * double(sampleCount - 1);
+                    std::size_t below = std::size_t(position);
+                    std::size_t above = std::min(below + 1, sampleCount - 1);
+                    double f = position - double(below);
+                    out[q * W] = (1.0 - f) * column[below] + f * column[above];
+                }
+            }
+
+            const double *spectra;
+            double *columns;
+            std::size_t sampleCount;
+            std::size_t wavelengthCount;
+            const double *quantiles;
+            std::size_t quantileCount;
+            double *outputs[4];
+        };
+
+        Task task = { spectra.data(), columns.data(), sampleCount, W, quantiles, quantileCount,
+                      { reflectanceP, reflectanceS, transmittanceP, transmittanceS } };
+        pool_.parallel_for_worker(4 * W, task);
+    }
+
+private:
+    ToleranceAnalysis(const ToleranceAnalysis &);
+    ToleranceAnalysis &operator=(const ToleranceAnalysis &);
+
+    struct alignas(64) Worker {
+        std::vector<double> thicknesses;
+        std::vector<complex> refractiveIndices;
+        std::vector<double> spectra;
+        std::size_t accepted;
+    };
+
+    // Draw number counter of the stream, it takes the values 2 counter and
+    // 2 counter + 1 whatever the distribution, so the draws never overlap
+    double error(const LayerTolerance &tolerance, double spread, std::uint64_t counter) const {
+        if (spread == 0.0) {
+            return 0.0;
+        }
+        if (tolerance.distribution == ErrorDistribution::Uniform) {
+            return spread * (2.0 * counter_uniform(seed_, 2 * counter) - 1.0);
+        }
+        return spread * counter_normal(seed_, counter);
+    }
+
+    // Perturb the stack in the buffers of the worker w and evaluate it
+    void evaluate(std::size_t w, std::size_t s,
+                  double *reflectanceP, double *reflectanceS,
+                  double *transmittanceP, double *transmittanceS) {
+        Worker &worker = workers_[w];
+        std::size_t N = layer_count();
+        std::size_t W = wavelength_count();
+
+        for (std::size_t i = 0; i < N; ++i) {
+            const LayerTolerance &tolerance = tolerances_[i];
+            std::uint64_t counter = 3 * (std::uint64_t(s) * N + i);
+            worker.thicknesses[i] = std::max(thicknesses_[i] + error(tolerance, tolerance.thickness, counter), 0.0);
+            complex delta(error(tolerance, tolerance.n, counter + 1), error(tolerance, tolerance.k, counter + 2));
+
+            const complex *nominal = &refractiveIndices_[i * W];
+            complex *perturbed = &worker.refractiveIndices[i * W];
+            for (std::size_t k = 0; k < W; ++k) {
+                complex n = nominal[k] + delta;
+                perturbed[k] = complex(n.real(), std::max(n.imag(), 0.0));
+            }
+        }
+
+        spectral_reflectance_transmittance_simd(incidentCosTheta_, nIncident_.data(), nExit_.data(),
+                                                worker.thicknesses.data(), N,
+                                                worker.refractiveIndices.data(),
+                                                wavelengths_.data(), W,
+                                                reflectanceP, reflectanceS, transmittanceP, transmittanceS);
+    }
+
+    WorkStealingPool &pool_;
+    complex incidentCosTheta_;
+    std::vector<complex> nIncident_;
+    std::vector<complex> nExit_;
+    std::vector<double> thicknesses_;
+    std::vector<complex> refractiveIndices_;
+    std::vector<LayerTolerance> tolerances_;
+    std::vector<double> wavelengths_;
+    std::uint64_t seed_;
+
+    std::vector<Worker> workers_;
+};
+
+}
+#endif